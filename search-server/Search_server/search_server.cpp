@@ -3,28 +3,133 @@
 void SearchServer::AddDocument(int document_id, std::string_view document,
                                DocumentStatus status,
                                const std::vector<int> &ratings) {
+  auto words = SplitNewDocument(document_id, document);
+  if (memory_budget_) {
+    ReserveMemory(EstimateDocumentMemory(document, words));
+  }
+  if (write_ahead_log_) {
+    const uint64_t lsn =
+        write_ahead_log_->AppendAdd(document_id, document, status, ratings);
+    if (wait_durable_) {
+      write_ahead_log_->WaitDurable(lsn);
+    }
+  }
+  IndexDocument(document_id, document, status, ratings, std::move(words));
+}
+
+void SearchServer::AddDocuments(const std::vector<NewDocument> &documents) {
+  std::vector<int> ids;
+  ids.reserve(documents.size());
+  for (const NewDocument &document : documents) {
+    ids.push_back(document.id);
+  }
+  std::sort(ids.begin(), ids.end());
+  if (std::adjacent_find(ids.begin(), ids.end()) != ids.end()) {
+    throw std::invalid_argument("Invalid document_id"s);
+  }
+
+  std::vector<std::vector<std::string_view>> document_words;
+  document_words.reserve(documents.size());
+  size_t required_memory = 0;
+  for (const NewDocument &document : documents) {
+    document_words.push_back(SplitNewDocument(document.id, document.text));
+    if (memory_budget_) {
+      required_memory +=
+          EstimateDocumentMemory(document.text, document_words.back());
+    }
+  }
+  if (memory_budget_) {
+    ReserveMemory(required_memory);
+  }
+  if (write_ahead_log_ && !documents.empty()) {
+    uint64_t lsn = 0;
+    for (const NewDocument &document : documents) {
+      lsn = write_ahead_log_->AppendAdd(document.id, document.text,
+                                        document.status, document.ratings);
+    }
+    if (wait_durable_) {
+      write_ahead_log_->WaitDurable(lsn);
+    }
+  }
+  for (size_t i = 0; i < documents.size(); ++i) {
+    IndexDocument(documents[i].id, documents[i].text, documents[i].status,
+                  documents[i].ratings, std::move(document_words[i]));
+  }
+}
+
+std::vector<std::string_view>
+SearchServer::SplitNewDocument(int document_id,
+                               std::string_view document) const {
   if ((document_id < 0) || (documents_.count(document_id) > 0)) {
     throw std::invalid_argument("Invalid document_id"s);
   }
+  return SplitIntoWordsNoStop(document);
+}
+
+void SearchServer::IndexDocument(int document_id, std::string_view document,
+                                 DocumentStatus status,
+                                 const std::vector<int> &ratings,
+                                 std::vector<std::string_view> words) {
+  const auto document_length = static_cast<uint32_t>(words.size());
   auto [get_data, _] = documents_.emplace(
-      document_id, DocumentData{ComputeAverageRating(ratings), status,
-                                std::string(document)});
-  const auto words = SplitIntoWordsNoStop(get_data->second.data);
+      document_id,
+      DocumentData{ComputeAverageRating(ratings), status, document_length,
+                   document_store_.Add(document)});
+  total_document_length_ += document_length;
+  memory_usage_.documents += TREE_NODE_SIZE<std::pair<const int, DocumentData>>;
 
+  // Ключи индекса указывают в словарь, а не в текст документа
   const double inv_word_count = 1.0 / words.size();
-  for (std::string_view word : words) {
-    word_to_document_freqs_[word][document_id] += inv_word_count;
+  for (std::string_view &word : words) {
+    const int term_id = terms_.Insert(word);
+    word = terms_.GetTerm(term_id);
+    if (static_cast<size_t>(term_id) >= term_to_document_freqs_.size()) {
+      memory_usage_.inverted_index -= term_to_document_freqs_.capacity() *
+                                      sizeof(std::map<int, Posting>);
+      term_to_document_freqs_.resize(term_id + 1);
+      memory_usage_.inverted_index += term_to_document_freqs_.capacity() *
+                                      sizeof(std::map<int, Posting>);
+    }
+    const auto [posting_it, is_new_posting] =
+        term_to_document_freqs_[term_id].try_emplace(document_id);
+    if (is_new_posting) {
+      terms_.AddReference(term_id);
+    }
+    Posting &posting = posting_it->second;
+    posting.term_freq += inv_word_count;
+    posting.document_length = document_length;
     id_to_document_freqs_[document_id][word] += inv_word_count;
   }
+  if (!words.empty()) {
+    const size_t unique_words = id_to_document_freqs_.at(document_id).size();
+    memory_usage_.inverted_index +=
+        unique_words * TREE_NODE_SIZE<std::pair<const int, Posting>>;
+    memory_usage_.forward_index +=
+        TREE_NODE_SIZE<
+            std::pair<const int, std::map<std::string_view, double>>> +
+        unique_words * TREE_NODE_SIZE<std::pair<const std::string_view, double>>;
+  }
+  if (positional_index_enabled_) {
+    AddDocumentPositions(document_id, words);
+  }
+  status_to_documents_[status].Set(document_id);
+  rating_to_documents_[get_data->second.rating].Set(document_id);
   document_ids_.insert(document_id);
+  memory_usage_.document_ids += TREE_NODE_SIZE<int>;
+}
+
+std::vector<Document>
+SearchServer::FindTopDocuments(std::string_view raw_query,
+                               const DocumentFilter &filter) const {
+  const auto filter_documents = BuildFilterDocuments(filter);
+  return FindPlannedDocuments(raw_query, MakeFilterAcceptor(filter_documents),
+                              true);
 }
 
 std::vector<Document>
 SearchServer::FindTopDocuments(std::string_view raw_query,
                                DocumentStatus status) const {
-  return FindTopDocuments(
-      raw_query, [status](int document_id, DocumentStatus document_status,
-                          int rating) { return document_status == status; });
+  return FindTopDocuments(raw_query, DocumentFilter(status));
 }
 
 std::vector<Document>
@@ -32,8 +137,63 @@ SearchServer::FindTopDocuments(std::string_view raw_query) const {
   return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
+SearchResult
+SearchServer::FindTopDocuments(std::string_view raw_query,
+                               const DocumentFilter &filter,
+                               const SearchOptions &options) const {
+  const SearchBudget budget(options);
+  const auto filter_documents = BuildFilterDocuments(filter);
+  auto matched_documents =
+      FindPlannedDocuments(raw_query, MakeFilterAcceptor(filter_documents),
+                           true, budget, options.match_mode);
+  return {std::move(matched_documents), !budget.WasExhausted()};
+}
+
+SearchResult
+SearchServer::FindTopDocuments(std::string_view raw_query,
+                               DocumentStatus status,
+                               const SearchOptions &options) const {
+  return FindTopDocuments(raw_query, DocumentFilter(status), options);
+}
+
+std::future<SearchResult>
+SearchServer::FindTopDocumentsAsync(std::string raw_query,
+                                    DocumentFilter filter,
+                                    SearchOptions options) const {
+  return std::async(std::launch::async,
+                    [this, raw_query = std::move(raw_query),
+                     filter = std::move(filter),
+                     options = std::move(options)] {
+                      return FindTopDocuments(raw_query, filter, options);
+                    });
+}
+
+QueryPlan SearchServer::ExplainQuery(std::string_view raw_query) const {
+  const auto query = ParseQuery(raw_query);
+
+  QueryPlan plan;
+  plan.is_parallel = PlanQuery(*query);
+  plan.estimated_work = query->estimated_work;
+  for (const auto &[document_count, word] : query->plus_postings) {
+    plan.plus_terms.push_back({word, document_count});
+  }
+  for (std::string_view word : query->minus_words) {
+    const auto *postings = FindPostings(word);
+    plan.minus_terms.push_back({word, postings ? postings->size() : 0});
+  }
+  return plan;
+}
+
 int SearchServer::GetDocumentCount() const { return documents_.size(); }
 
+std::string SearchServer::GetDocumentText(int document_id) const {
+  const auto found = documents_.find(document_id);
+  if (found == documents_.end()) {
+    throw std::out_of_range("Unknown document_id"s);
+  }
+  return document_store_.Get(found->second.text);
+}
+
 std::set<int>::const_iterator SearchServer::begin() {
   return document_ids_.begin();
 }
@@ -48,28 +208,198 @@ void SearchServer::RemoveDocument(int document_id) {
 
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy &,
                                   int document_id) {
-  if (document_ids_.count(document_id)) {
-    for_each(std::execution::seq, word_to_document_freqs_.begin(),
-             word_to_document_freqs_.end(),
-             [document_id](auto &i) { i.second.erase(document_id); });
-    documents_.erase(document_id);
-    id_to_document_freqs_.erase(document_id);
-    document_ids_.erase(document_id);
-  }
+  RemoveDocumentFromIndex(std::execution::seq, document_id);
 }
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy &,
                                   int document_id) {
-  if (document_ids_.count(document_id)) {
-    for_each(std::execution::par, word_to_document_freqs_.begin(),
-             word_to_document_freqs_.end(),
-             [document_id](auto &i) { i.second.erase(document_id); });
-    documents_.erase(document_id);
-    id_to_document_freqs_.erase(document_id);
-    document_ids_.erase(document_id);
+  RemoveDocumentFromIndex(std::execution::par, document_id);
+}
+
+template <typename Policy>
+void SearchServer::RemoveDocumentFromIndex(Policy policy, int document_id) {
+  if (!document_ids_.count(document_id)) {
+    return;
+  }
+  if (write_ahead_log_) {
+    const uint64_t lsn = write_ahead_log_->AppendRemove(document_id);
+    if (wait_durable_) {
+      write_ahead_log_->WaitDurable(lsn);
+    }
+  }
+  RemoveDocumentPositions(document_id);
+  RemoveDocumentFilters(document_id);
+
+  // Обходим только слова документа, а не весь индекс
+  const auto word_freqs = id_to_document_freqs_.find(document_id);
+  if (word_freqs != id_to_document_freqs_.end()) {
+    std::vector<int> term_ids;
+    term_ids.reserve(word_freqs->second.size());
+    for (const auto &[word, _] : word_freqs->second) {
+      term_ids.push_back(terms_.Find(word));
+    }
+    std::for_each(policy, term_ids.begin(), term_ids.end(),
+                  [this, document_id](int term_id) {
+                    term_to_document_freqs_[term_id].erase(document_id);
+                  });
+    for (const int term_id : term_ids) {
+      terms_.RemoveReference(term_id);
+    }
+
+    const size_t unique_words = word_freqs->second.size();
+    memory_usage_.inverted_index -=
+        unique_words * TREE_NODE_SIZE<std::pair<const int, Posting>>;
+    memory_usage_.forward_index -=
+        TREE_NODE_SIZE<
+            std::pair<const int, std::map<std::string_view, double>>> +
+        unique_words * TREE_NODE_SIZE<std::pair<const std::string_view, double>>;
+    id_to_document_freqs_.erase(word_freqs);
+  }
+
+  const auto document_data = documents_.find(document_id);
+  total_document_length_ -= document_data->second.length;
+  memory_usage_.documents -= TREE_NODE_SIZE<std::pair<const int, DocumentData>>;
+  document_store_.Remove(document_data->second.text);
+  documents_.erase(document_data);
+  document_ids_.erase(document_id);
+  memory_usage_.document_ids -= TREE_NODE_SIZE<int>;
+
+  // Ссылок на строки удалённых терминов в индексах уже не осталось
+  if (terms_.HasManyUnused()) {
+    terms_.RemoveUnused();
   }
 }
 
+void SearchServer::AttachWriteAheadLog(const std::string &path,
+                                       std::chrono::microseconds commit_interval,
+                                       bool wait_durable) {
+  // Восстановление поверх имеющихся документов разошлось бы с журналом
+  if (write_ahead_log_ || !documents_.empty()) {
+    throw std::logic_error(
+        "Write-ahead log can be attached only to an empty server"s);
+  }
+  auto write_ahead_log =
+      std::make_unique<WriteAheadLog>(path, commit_interval);
+  write_ahead_log->Replay([this](const WriteAheadLog::Record &record) {
+    if (record.type == WriteAheadLog::RecordType::ADD) {
+      AddDocument(record.document_id, record.text, record.status,
+                  record.ratings);
+    } else {
+      RemoveDocument(record.document_id);
+    }
+  });
+  write_ahead_log_ = std::move(write_ahead_log);
+  wait_durable_ = wait_durable;
+}
+
+void SearchServer::SyncWriteAheadLog() {
+  if (write_ahead_log_) {
+    write_ahead_log_->Sync();
+  }
+}
+
+void SearchServer::Checkpoint() {
+  if (!write_ahead_log_) {
+    return;
+  }
+  write_ahead_log_->Checkpoint([this](auto emit) {
+    WriteAheadLog::Record record;
+    std::string text;
+    for (const auto &[document_id, document_data] : documents_) {
+      record.document_id = document_id;
+      record.status = document_data.status;
+      // Средний рейтинг от одной оценки равен ей самой
+      record.ratings = {document_data.rating};
+      text = document_store_.Get(document_data.text);
+      record.text = text;
+      emit(record);
+    }
+  });
+}
+
+MemoryUsage SearchServer::GetMemoryUsage() const {
+  MemoryUsage usage = memory_usage_;
+  usage.term_dictionary = terms_.MemoryUsage();
+  usage.document_texts = document_store_.MemoryUsage();
+  for (const auto &[_, documents] : status_to_documents_) {
+    usage.filters += TREE_NODE_SIZE<std::pair<const DocumentStatus, int>> +
+                     documents.MemoryUsage();
+  }
+  for (const auto &[_, documents] : rating_to_documents_) {
+    usage.filters +=
+        TREE_NODE_SIZE<std::pair<const int, int>> + documents.MemoryUsage();
+  }
+  return usage;
+}
+
+void SearchServer::SetMemoryBudget(std::optional<size_t> budget) {
+  memory_budget_ = budget;
+}
+
+void SearchServer::Compact() {
+  // Списки удалённых терминов пусты, хвост вектора им больше не нужен
+  terms_.ShrinkToFit();
+  memory_usage_.inverted_index -=
+      term_to_document_freqs_.capacity() * sizeof(std::map<int, Posting>);
+  term_to_document_freqs_.resize(
+      std::min(term_to_document_freqs_.size(), terms_.size()));
+  term_to_document_freqs_.shrink_to_fit();
+  memory_usage_.inverted_index +=
+      term_to_document_freqs_.capacity() * sizeof(std::map<int, Posting>);
+  document_store_.Compact();
+  for (auto &[_, documents] : status_to_documents_) {
+    documents.ShrinkToFit();
+  }
+  for (auto &[_, documents] : rating_to_documents_) {
+    documents.ShrinkToFit();
+  }
+  memory_usage_.positional_index = 0;
+  for (auto &[_, document_positions] : word_to_document_positions_) {
+    for (auto &[_, positions] : document_positions) {
+      positions.ShrinkToFit();
+      memory_usage_.positional_index += PositionsMemory(positions);
+    }
+  }
+}
+
+size_t SearchServer::EstimateDocumentMemory(
+    std::string_view document,
+    const std::vector<std::string_view> &words) const {
+  size_t estimate = TREE_NODE_SIZE<std::pair<const int, DocumentData>> +
+                    document.size() + 1 + TREE_NODE_SIZE<int> +
+                    TREE_NODE_SIZE<
+                        std::pair<const int, std::map<std::string_view, double>>>;
+  // Повторы слов считаются несколько раз, поэтому оценка сверху
+  for (std::string_view word : words) {
+    estimate += TREE_NODE_SIZE<std::pair<const int, Posting>> +
+                TREE_NODE_SIZE<std::pair<const std::string_view, double>>;
+    if (positional_index_enabled_) {
+      estimate += TREE_NODE_SIZE<std::pair<const int, PositionList>> + 5;
+    }
+    if (terms_.Find(word) == TermDictionary::NOT_FOUND) {
+      // Список документов может удвоить вектор списков
+      estimate += word.size() + sizeof(std::string_view) + sizeof(int) +
+                  2 * sizeof(std::map<int, Posting>);
+    }
+  }
+  return estimate;
+}
+
+void SearchServer::ReserveMemory(size_t required) {
+  if (GetMemoryUsage().Total() + required <= *memory_budget_) {
+    return;
+  }
+  Compact();
+  if (GetMemoryUsage().Total() + required > *memory_budget_) {
+    throw std::length_error("Memory budget exceeded"s);
+  }
+}
+
+size_t SearchServer::PositionsMemory(const PositionList &positions) {
+  return TREE_NODE_SIZE<std::pair<const int, PositionList>> -
+         sizeof(PositionList) + positions.MemoryUsage();
+}
+
 const std::map<std::string_view, double> &
 SearchServer::GetWordFrequencies(int document_id) const {
   std::map<std::string_view, double> empty;
@@ -78,24 +408,187 @@ SearchServer::GetWordFrequencies(int document_id) const {
              : id_to_document_freqs_.at(document_id);
 }
 
+void SearchServer::EnablePositionalIndex(bool enable) {
+  if (enable == positional_index_enabled_) {
+    return;
+  }
+  positional_index_enabled_ = enable;
+  if (!enable) {
+    word_to_document_positions_.clear();
+    memory_usage_.positional_index = 0;
+    return;
+  }
+  for (const auto &[document_id, document_data] : documents_) {
+    const std::string text = document_store_.Get(document_data.text);
+    auto words = SplitIntoWordsNoStop(text);
+    for (std::string_view &word : words) {
+      word = terms_.GetTerm(terms_.Find(word));
+    }
+    AddDocumentPositions(document_id, words);
+  }
+}
+
+void SearchServer::SetTypoTolerance(int max_edits) {
+  if (max_edits < 0 || max_edits > 2) {
+    throw std::invalid_argument("Typo tolerance must be from 0 to 2"s);
+  }
+  typo_tolerance_ = max_edits;
+}
+
+int SearchServer::GetTypoTolerance() const { return typo_tolerance_; }
+
+bool SearchServer::IsPositionalIndexEnabled() const {
+  return positional_index_enabled_;
+}
+
+size_t SearchServer::GetPositionalIndexMemoryUsage() const {
+  return memory_usage_.positional_index;
+}
+
+void SearchServer::AddDocumentPositions(
+    int document_id, const std::vector<std::string_view> &words) {
+  for (uint32_t position = 0; position < words.size(); ++position) {
+    word_to_document_positions_[words[position]][document_id].Append(position);
+  }
+  if (!id_to_document_freqs_.count(document_id)) {
+    return;
+  }
+  for (const auto &[word, _] : id_to_document_freqs_.at(document_id)) {
+    memory_usage_.positional_index +=
+        PositionsMemory(word_to_document_positions_.at(word).at(document_id));
+  }
+}
+
+void SearchServer::RemoveDocumentPositions(int document_id) {
+  if (!positional_index_enabled_ || !id_to_document_freqs_.count(document_id)) {
+    return;
+  }
+  for (const auto &[word, _] : id_to_document_freqs_.at(document_id)) {
+    const auto found = word_to_document_positions_.find(word);
+    if (found == word_to_document_positions_.end()) {
+      continue;
+    }
+    auto &document_positions = found->second;
+    memory_usage_.positional_index -=
+        PositionsMemory(document_positions.at(document_id));
+    document_positions.erase(document_id);
+    if (document_positions.empty()) {
+      word_to_document_positions_.erase(found);
+    }
+  }
+}
+
+void SearchServer::RemoveDocumentFilters(int document_id) {
+  const auto &document_data = documents_.at(document_id);
+  status_to_documents_[document_data.status].Reset(document_id);
+  const auto rating = rating_to_documents_.find(document_data.rating);
+  rating->second.Reset(document_id);
+  if (rating->second.empty()) {
+    rating_to_documents_.erase(rating);
+  }
+}
+
+SearchServer::FilterDocuments
+SearchServer::BuildFilterDocuments(const DocumentFilter &filter) const {
+  static const DocumentBitmap no_documents;
+  FilterDocuments result;
+  if (filter.status) {
+    const auto found = status_to_documents_.find(*filter.status);
+    result.status_documents =
+        found == status_to_documents_.end() ? &no_documents : &found->second;
+  }
+  if (filter.min_rating || filter.max_rating) {
+    // Объединяем корзины рейтингов из диапазона
+    auto first = filter.min_rating
+                     ? rating_to_documents_.lower_bound(*filter.min_rating)
+                     : rating_to_documents_.begin();
+    auto last = filter.max_rating
+                    ? rating_to_documents_.upper_bound(*filter.max_rating)
+                    : rating_to_documents_.end();
+    DocumentBitmap in_range;
+    if (!filter.min_rating || !filter.max_rating ||
+        *filter.min_rating <= *filter.max_rating) {
+      for (; first != last; ++first) {
+        in_range |= first->second;
+      }
+    }
+    if (result.status_documents) {
+      in_range &= *result.status_documents;
+    }
+    result.rated_documents = std::move(in_range);
+  }
+  return result;
+}
+
+bool SearchServer::MatchesPhrase(
+    std::vector<std::string_view>::const_iterator first,
+    std::vector<std::string_view>::const_iterator last,
+    int document_id) const {
+  std::vector<std::vector<uint32_t>> positions;
+  positions.reserve(last - first);
+  for (auto word = first; word != last; ++word) {
+    const auto found = word_to_document_positions_.find(*word);
+    if (found == word_to_document_positions_.end()) {
+      return false;
+    }
+    const auto document_positions = found->second.find(document_id);
+    if (document_positions == found->second.end()) {
+      return false;
+    }
+    positions.push_back(document_positions->second.Decode());
+  }
+
+  // Ищем такую позицию первого слова, что i-е слово фразы стоит на i позиций
+  // правее
+  for (const uint32_t start : positions[0]) {
+    bool matched = true;
+    for (uint32_t offset = 1; offset < positions.size(); ++offset) {
+      if (!std::binary_search(positions[offset].begin(),
+                              positions[offset].end(), start + offset)) {
+        matched = false;
+        break;
+      }
+    }
+    if (matched) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SearchServer::MatchesPhrases(const Query &query, int document_id) const {
+  if (!positional_index_enabled_) {
+    return true;
+  }
+  auto phrase_begin = query.phrase_words.begin();
+  for (const size_t phrase_end : query.phrase_ends) {
+    const auto phrase_end_it = query.phrase_words.begin() + phrase_end;
+    if (!MatchesPhrase(phrase_begin, phrase_end_it, document_id)) {
+      return false;
+    }
+    phrase_begin = phrase_end_it;
+  }
+  return true;
+}
+
 std::tuple<std::vector<std::string_view>, DocumentStatus>
 SearchServer::MatchDocument(std::string_view raw_query, int document_id) const {
-  const auto query = ParseQuery(raw_query, true);
+  const auto query = ParseQuery(raw_query);
 
   std::vector<std::string_view> matched_words;
-  for (std::string_view word : query.minus_words) {
-    if (word_to_document_freqs_.count(word) == 0) {
-      continue;
-    }
-    if (word_to_document_freqs_.at(word).count(document_id)) {
+  for (std::string_view word : query->minus_words) {
+    const auto *postings = FindPostings(word);
+    if (postings && postings->count(document_id)) {
       return {matched_words, documents_.at(document_id).status};
     }
   }
-  for (std::string_view word : query.plus_words) {
-    if (word_to_document_freqs_.count(word) == 0) {
-      continue;
-    }
-    if (word_to_document_freqs_.at(word).count(document_id)) {
+  // Документ без фразы запроса не подходит, как и документ с минус-словом
+  if (!MatchesPhrases(*query, document_id)) {
+    return {matched_words, documents_.at(document_id).status};
+  }
+  for (std::string_view word : query->plus_words) {
+    const auto *postings = FindPostings(word);
+    if (postings && postings->count(document_id)) {
       matched_words.push_back(word);
     }
   }
@@ -112,33 +605,124 @@ SearchServer::MatchDocument(const std::execution::sequenced_policy &,
 std::tuple<std::vector<std::string_view>, DocumentStatus>
 SearchServer::MatchDocument(const std::execution::parallel_policy &,
                             std::string_view raw_query, int document_id) const {
-  const auto query = ParseQuery(raw_query, false);
+  const auto query = ParseQuery(raw_query);
 
-  if (std::any_of(std::execution::par, query.minus_words.begin(),
-                  query.minus_words.end(),
+  if (std::any_of(std::execution::par, query->minus_words.begin(),
+                  query->minus_words.end(),
                   [document_id, this](std::string_view minus) {
-                    const auto &find = word_to_document_freqs_.find(minus);
-                    return (find != word_to_document_freqs_.end()) &&
-                           find->second.count(document_id);
-                  })) {
+                    const auto *postings = FindPostings(minus);
+                    return postings && postings->count(document_id);
+                  }) ||
+      !MatchesPhrases(*query, document_id)) {
     std::vector<std::string_view> empty;
     return {empty, documents_.at(document_id).status};
   }
-  std::vector<std::string_view> matched_words(query.plus_words.size());
+  // Слова запроса уже без повторов, а copy_if сохраняет их порядок
+  std::vector<std::string_view> matched_words(query->plus_words.size());
   auto iter = std::copy_if(
-      std::execution::par, query.plus_words.begin(), query.plus_words.end(),
+      std::execution::par, query->plus_words.begin(), query->plus_words.end(),
       matched_words.begin(), [document_id, this](std::string_view plus) {
-        const auto &find = word_to_document_freqs_.find(plus);
-        return (find != word_to_document_freqs_.end()) &&
-               find->second.count(document_id);
+        const auto *postings = FindPostings(plus);
+        return postings && postings->count(document_id);
       });
-  std::sort(std::execution::par, matched_words.begin(), iter);
-  matched_words.erase(
-      std::unique(std::execution::par, matched_words.begin(), iter),
-      matched_words.end());
+  matched_words.erase(iter, matched_words.end());
   return {matched_words, documents_.at(document_id).status};
 }
 
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+SearchServer::MatchDocuments(std::string_view raw_query,
+                             const std::vector<int> &document_ids) const {
+  return MatchDocuments(std::execution::seq, raw_query, document_ids);
+}
+
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+SearchServer::MatchDocuments(const std::execution::sequenced_policy &,
+                             std::string_view raw_query,
+                             const std::vector<int> &document_ids) const {
+  const auto query = ParseQuery(raw_query);
+
+  std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+      matched_documents;
+  matched_documents.reserve(document_ids.size());
+  for (const int document_id : document_ids) {
+    matched_documents.push_back(MatchParsedQuery(*query, document_id));
+  }
+  return matched_documents;
+}
+
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+SearchServer::MatchDocuments(const std::execution::parallel_policy &,
+                             std::string_view raw_query,
+                             const std::vector<int> &document_ids) const {
+  const auto query = ParseQuery(raw_query);
+
+  // Исключение внутри параллельного алгоритма приводит к std::terminate,
+  // поэтому id проверяются заранее
+  for (const int document_id : document_ids) {
+    if (documents_.count(document_id) == 0) {
+      throw std::out_of_range("Document "s + std::to_string(document_id) +
+                              " not found"s);
+    }
+  }
+
+  std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+      matched_documents(document_ids.size());
+  std::transform(std::execution::par, document_ids.begin(),
+                 document_ids.end(), matched_documents.begin(),
+                 [&query, this](int document_id) {
+                   return MatchParsedQuery(*query, document_id);
+                 });
+  return matched_documents;
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus>
+SearchServer::MatchParsedQuery(const Query &query, int document_id) const {
+  const DocumentStatus status = documents_.at(document_id).status;
+  const auto found = id_to_document_freqs_.find(document_id);
+  if (found == id_to_document_freqs_.end()) {
+    return {std::vector<std::string_view>{}, status};
+  }
+  const auto &word_freqs = found->second;
+
+  // Слова запроса и ключи прямого индекса отсортированы одинаково,
+  // поэтому пересечение делается за один проход
+  const auto intersect = [&word_freqs](
+                             const std::vector<std::string_view> &words,
+                             auto on_match) {
+    auto word_it = words.begin();
+    auto doc_it = word_freqs.begin();
+    while (word_it != words.end() && doc_it != word_freqs.end()) {
+      if (*word_it < doc_it->first) {
+        ++word_it;
+      } else if (doc_it->first < *word_it) {
+        ++doc_it;
+      } else {
+        if (!on_match(doc_it->first)) {
+          return;
+        }
+        ++word_it;
+        ++doc_it;
+      }
+    }
+  };
+
+  bool has_minus = false;
+  intersect(query.minus_words, [&has_minus](std::string_view) {
+    has_minus = true;
+    return false;
+  });
+  if (has_minus || !MatchesPhrases(query, document_id)) {
+    return {std::vector<std::string_view>{}, status};
+  }
+
+  std::vector<std::string_view> matched_words;
+  intersect(query.plus_words, [&matched_words](std::string_view word) {
+    matched_words.push_back(word);
+    return true;
+  });
+  return {matched_words, status};
+}
+
 bool SearchServer::IsStopWord(std::string_view word) const {
   return stop_words_.count(word) > 0;
 }
@@ -173,43 +757,315 @@ SearchServer::ParseQueryWord(std::string_view text) const {
                                 " is invalid"s);
   }
 
-  return {text, is_minus, IsStopWord(text)};
+  bool is_prefix = false;
+  if (text.size() > 1 && text.back() == '*') {
+    is_prefix = true;
+    text.remove_suffix(1);
+  }
+
+  return {text, is_minus, IsStopWord(text), is_prefix};
+}
+
+void SearchServer::Query::Clear() {
+  plus_words.clear();
+  minus_words.clear();
+  phrase_words.clear();
+  phrase_ends.clear();
+  exact_words.clear();
+  prefix_words.clear();
+  prefix_ends.clear();
+  plus_postings.clear();
+  estimated_work = 0;
+  word_weights.clear();
 }
 
-SearchServer::Query SearchServer::ParseQuery(std::string_view text,
-                                             bool seq) const {
-  Query result;
-  for (std::string_view word : SplitIntoWords(text)) {
-    const auto query_word = ParseQueryWord(word);
-    if (!query_word.is_stop) {
-      if (query_word.is_minus) {
-        result.minus_words.push_back(query_word.data);
+double SearchServer::Query::GetWeight(std::string_view word) const {
+  for (const auto &[weighted_word, weight] : word_weights) {
+    if (weighted_word == word) {
+      return weight;
+    }
+  }
+  return 1.0;
+}
+
+std::vector<std::unique_ptr<SearchServer::Query>> &
+SearchServer::QueryContext::Pool() {
+  thread_local std::vector<std::unique_ptr<Query>> pool;
+  return pool;
+}
+
+SearchServer::QueryContext::QueryContext() {
+  auto &pool = Pool();
+  if (pool.empty()) {
+    query_ = std::make_unique<Query>();
+  } else {
+    query_ = std::move(pool.back());
+    pool.pop_back();
+  }
+}
+
+SearchServer::QueryContext::~QueryContext() {
+  if (query_) {
+    query_->Clear();
+    Pool().push_back(std::move(query_));
+  }
+}
+
+SearchServer::QueryContext
+SearchServer::ParseQuery(std::string_view text) const {
+  QueryContext context;
+  Query &result = *context;
+  bool in_phrase = false;
+  ForEachWord(text, [this, &result, &in_phrase](std::string_view word) {
+    // Фраза в кавычках: "curly tail"
+    bool phrase_end = false;
+    if (!in_phrase && word[0] == '"') {
+      in_phrase = true;
+      word.remove_prefix(1);
+      result.phrase_ends.push_back(result.phrase_words.size());
+    }
+    if (in_phrase && !word.empty() && word.back() == '"') {
+      phrase_end = true;
+      word.remove_suffix(1);
+    }
+    if (!word.empty() || !in_phrase) {
+      const auto query_word = ParseQueryWord(word);
+      if (in_phrase && query_word.is_minus) {
+        throw std::invalid_argument("Minus word "s + std::string(word) +
+                                    " inside phrase"s);
+      }
+      if (in_phrase && query_word.is_prefix) {
+        throw std::invalid_argument("Prefix word "s + std::string(word) +
+                                    " inside phrase"s);
+      }
+      if (query_word.is_prefix) {
+        // Префиксный запрос cat* раскрывается по словарю терминов.
+        // Термины без документов словарь пропускает сам.
+        auto &words =
+            query_word.is_minus ? result.minus_words : result.prefix_words;
+        size_t expansion_count = 0;
+        terms_.ForEachWithPrefix(
+            query_word.data,
+            [this, &words, &expansion_count](int term_id) {
+              words.push_back(terms_.GetTerm(term_id));
+              return ++expansion_count < MAX_PREFIX_EXPANSIONS;
+            },
+            MAX_PREFIX_SCAN);
+        if (!query_word.is_minus) {
+          result.prefix_ends.push_back(result.prefix_words.size());
+        }
+      } else if (!query_word.is_stop) {
+        if (query_word.is_minus) {
+          result.minus_words.push_back(query_word.data);
+        } else {
+          result.exact_words.push_back(query_word.data);
+          if (in_phrase) {
+            result.phrase_words.push_back(query_word.data);
+          }
+        }
+      }
+    }
+    if (phrase_end) {
+      in_phrase = false;
+      // Фразе из одного слова достаточно обычного поиска
+      if (result.phrase_words.size() - result.phrase_ends.back() > 1) {
+        result.phrase_ends.back() = result.phrase_words.size();
       } else {
-        result.plus_words.push_back(query_word.data);
+        result.phrase_words.resize(result.phrase_ends.back());
+        result.phrase_ends.pop_back();
       }
     }
+  });
+  if (in_phrase) {
+    throw std::invalid_argument("Phrase is not closed"s);
   }
 
-  if (seq) {
-    std::sort(std::execution::seq, result.minus_words.begin(),
-              result.minus_words.end());
-    std::sort(std::execution::seq, result.plus_words.begin(),
-              result.plus_words.end());
-    result.minus_words.erase(std::unique(std::execution::seq,
-                                         result.minus_words.begin(),
-                                         result.minus_words.end()),
-                             result.minus_words.end());
-    result.plus_words.erase(std::unique(std::execution::seq,
-                                        result.plus_words.begin(),
-                                        result.plus_words.end()),
-                            result.plus_words.end());
+  std::sort(result.minus_words.begin(), result.minus_words.end());
+  result.minus_words.erase(
+      std::unique(result.minus_words.begin(), result.minus_words.end()),
+      result.minus_words.end());
+  std::sort(result.exact_words.begin(), result.exact_words.end());
+  result.exact_words.erase(
+      std::unique(result.exact_words.begin(), result.exact_words.end()),
+      result.exact_words.end());
+
+  result.plus_words.assign(result.exact_words.begin(),
+                           result.exact_words.end());
+  result.plus_words.insert(result.plus_words.end(),
+                           result.prefix_words.begin(),
+                           result.prefix_words.end());
+  std::sort(result.plus_words.begin(), result.plus_words.end());
+  result.plus_words.erase(
+      std::unique(result.plus_words.begin(), result.plus_words.end()),
+      result.plus_words.end());
+
+  // Группа префикса, в которую попало явное слово, им уже выполнена,
+  // а повтор группы ничего не добавляет к условию
+  size_t kept_words = 0;
+  size_t kept_groups = 0;
+  size_t group_begin = 0;
+  for (const size_t group_end : result.prefix_ends) {
+    const auto begin = result.prefix_words.begin() + group_begin;
+    const auto end = result.prefix_words.begin() + group_end;
+    const bool has_exact_word =
+        std::any_of(begin, end, [&result](std::string_view word) {
+          return std::binary_search(result.exact_words.begin(),
+                                    result.exact_words.end(), word);
+        });
+    bool is_repeated = false;
+    size_t kept_begin = 0;
+    for (size_t g = 0; g < kept_groups && !is_repeated; ++g) {
+      const size_t kept_end = result.prefix_ends[g];
+      is_repeated =
+          std::equal(result.prefix_words.begin() + kept_begin,
+                     result.prefix_words.begin() + kept_end, begin, end);
+      kept_begin = kept_end;
+    }
+    if (!has_exact_word && !is_repeated) {
+      for (size_t i = group_begin; i < group_end; ++i) {
+        result.prefix_words[kept_words++] = result.prefix_words[i];
+      }
+      result.prefix_ends[kept_groups++] = kept_words;
+    }
+    group_begin = group_end;
   }
+  result.prefix_words.resize(kept_words);
+  result.prefix_ends.resize(kept_groups);
 
-  return result;
+  if (typo_tolerance_ > 0) {
+    ExpandTypos(result);
+  }
+
+  return context;
 }
 
-double
-SearchServer::ComputeWordInverseDocumentFreq(std::string_view &word) const {
-  return std::log(GetDocumentCount() * 1.0 /
-                  word_to_document_freqs_.at(word).size());
+void SearchServer::ExpandTypos(Query &query) const {
+  const size_t word_count = query.plus_words.size();
+  for (size_t i = 0; i < word_count; ++i) {
+    const std::string_view word = query.plus_words[i];
+    if (FindPostings(word)) {
+      continue;
+    }
+    // Сначала самые близкие, среди них - самые частые термины
+    std::vector<std::tuple<int, size_t, std::string_view>> candidates;
+    for (const auto &[term_id, distance] :
+         terms_.FindSimilar(word, typo_tolerance_)) {
+      const std::string_view term = terms_.GetTerm(term_id);
+      const auto *postings = FindPostings(term);
+      if (postings) {
+        candidates.emplace_back(distance, postings->size(), term);
+      }
+    }
+    const size_t expansion_count =
+        std::min(candidates.size(), MAX_TYPO_EXPANSIONS);
+    std::partial_sort(candidates.begin(),
+                      candidates.begin() + expansion_count, candidates.end(),
+                      [](const auto &lhs, const auto &rhs) {
+                        return std::get<0>(lhs) != std::get<0>(rhs)
+                                   ? std::get<0>(lhs) < std::get<0>(rhs)
+                                   : std::get<1>(lhs) > std::get<1>(rhs);
+                      });
+
+    for (size_t j = 0; j < expansion_count; ++j) {
+      const auto [distance, _, term] = candidates[j];
+      // Слово, которое и так есть в запросе, сохраняет полный вес
+      if (std::binary_search(query.plus_words.begin(),
+                             query.plus_words.begin() + word_count, term)) {
+        continue;
+      }
+      const double weight = std::pow(TYPO_EDIT_WEIGHT, distance);
+      const auto weighted = std::find_if(
+          query.word_weights.begin(), query.word_weights.end(),
+          [term = term](const auto &item) { return item.first == term; });
+      if (weighted == query.word_weights.end()) {
+        query.plus_words.push_back(term);
+        query.word_weights.emplace_back(term, weight);
+      } else {
+        weighted->second = std::max(weighted->second, weight);
+      }
+    }
+  }
+  std::sort(query.plus_words.begin(), query.plus_words.end());
+}
+
+bool SearchServer::PlanQuery(Query &query) const {
+  const auto document_count = [this](std::string_view word) -> size_t {
+    const auto *postings = FindPostings(word);
+    return postings ? postings->size() : 0;
+  };
+
+  query.estimated_work = 0;
+  for (std::string_view word : query.minus_words) {
+    query.estimated_work += document_count(word);
+  }
+  query.plus_postings.clear();
+  for (std::string_view word : query.plus_words) {
+    query.plus_postings.emplace_back(document_count(word), word);
+    query.estimated_work += query.plus_postings.back().first;
+  }
+
+  // Самые избирательные слова обрабатываются первыми
+  std::sort(query.plus_postings.begin(), query.plus_postings.end());
+  for (size_t i = 0; i < query.plus_postings.size(); ++i) {
+    query.plus_words[i] = query.plus_postings[i].second;
+  }
+
+  // Параллельная версия распределяет по потокам слова, поэтому
+  // для одного слова она только добавляет накладные расходы
+  return query.plus_words.size() > 1 &&
+         query.estimated_work >= PARALLEL_WORK_THRESHOLD;
+}
+
+DocumentBitmap SearchServer::BuildExclusionBitmap(const Query &query) const {
+  DocumentBitmap excluded_documents;
+  for (std::string_view word : query.minus_words) {
+    const auto *postings = FindPostings(word);
+    if (!postings) {
+      continue;
+    }
+    for (const auto [document_id, _] : *postings) {
+      excluded_documents.Set(document_id);
+    }
+  }
+  return excluded_documents;
+}
+
+std::map<int, Posting>::const_iterator
+SearchServer::SkipTo(const std::map<int, Posting> &postings,
+                     std::map<int, Posting>::const_iterator position,
+                     int document_id) {
+  // Списки похожей длины выгоднее проходить подряд: спуск по дереву
+  // дороже нескольких шагов итератора
+  constexpr int LINEAR_STEPS = 8;
+  for (int step = 0; step < LINEAR_STEPS; ++step) {
+    if (position == postings.end() || position->first >= document_id) {
+      return position;
+    }
+    ++position;
+  }
+  if (position == postings.end() || position->first >= document_id) {
+    return position;
+  }
+  return postings.lower_bound(document_id);
+}
+
+const std::map<int, Posting> *
+SearchServer::FindPostings(std::string_view word) const {
+  const int term_id = terms_.Find(word);
+  if (term_id == TermDictionary::NOT_FOUND ||
+      static_cast<size_t>(term_id) >= term_to_document_freqs_.size() ||
+      term_to_document_freqs_[term_id].empty()) {
+    return nullptr;
+  }
+  return &term_to_document_freqs_[term_id];
+}
+
+CollectionStats SearchServer::GetCollectionStats() const {
+  CollectionStats stats;
+  stats.document_count = documents_.size();
+  if (stats.document_count > 0) {
+    stats.average_document_length =
+        static_cast<double>(total_document_length_) / stats.document_count;
+  }
+  return stats;
 }
@@ -2,14 +2,26 @@
 
 #include "../Utility/concurrent_map.h"
 #include "../Utility/document.h"
+#include "../Utility/document_bitmap.h"
+#include "../Utility/document_store.h"
+#include "../Utility/memory_usage.h"
+#include "../Utility/position_list.h"
+#include "../Utility/query_plan.h"
+#include "../Utility/scorer.h"
+#include "../Utility/search_options.h"
 #include "../Utility/string_processing.h"
+#include "../Utility/term_dictionary.h"
+#include "../Utility/write_ahead_log.h"
 
 #include <algorithm>
 #include <cmath>
 #include <execution>
+#include <future>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <numeric>
+#include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
@@ -19,6 +31,18 @@
 
 constexpr int MAX_RESULT_DOCUMENT_COUNT = 5;
 constexpr double EPSILON = 1e-6;
+// Начиная с такой оценки работы запрос без явной политики выполняется
+// параллельно
+constexpr size_t PARALLEL_WORK_THRESHOLD = 20000;
+// Исправление опечаток: сколько похожих терминов подставляется вместо
+// одного ненайденного слова и во сколько раз каждая правка снижает вес
+constexpr size_t MAX_TYPO_EXPANSIONS = 3;
+constexpr double TYPO_EDIT_WEIGHT = 0.5;
+// Сколько терминов подставляется вместо префиксного слова запроса (cat*)
+// и сколько терминов словаря при этом просматривается, считая термины
+// удалённых документов, которые словарь ещё не освободил
+constexpr size_t MAX_PREFIX_EXPANSIONS = 64;
+constexpr size_t MAX_PREFIX_SCAN = 4096;
 
 class SearchServer {
 public:
@@ -33,12 +57,20 @@ public:
   // Добавление документа
   void AddDocument(int document_id, std::string_view document,
                    DocumentStatus status, const std::vector<int> &ratings);
-
-  // Поиск Подходящих документов
+  // Пакетное добавление: либо добавляются все документы, либо при ошибке
+  // проверки ни один. С журналом запись на диск ожидается один раз
+  // на весь пакет, а не на каждый документ.
+  void AddDocuments(const std::vector<NewDocument> &documents);
+
+  // Поиск Подходящих документов. Без явной политики запрос с DocumentFilter
+  // или статусом может выполняться параллельно, а пользовательский предикат
+  // всегда вызывается из одного потока.
   template <typename DocumentPredicate>
   std::vector<Document>
   FindTopDocuments(std::string_view raw_query,
                    DocumentPredicate document_predicate) const;
+  std::vector<Document> FindTopDocuments(std::string_view raw_query,
+                                         const DocumentFilter &filter) const;
   std::vector<Document> FindTopDocuments(std::string_view raw_query,
                                          DocumentStatus status) const;
   std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
@@ -48,6 +80,10 @@ public:
   FindTopDocuments(Policy policy, std::string_view raw_query,
                    DocumentPredicate document_predicate) const;
   template <typename Policy>
+  std::vector<Document> FindTopDocuments(Policy policy,
+                                         std::string_view raw_query,
+                                         const DocumentFilter &filter) const;
+  template <typename Policy>
   std::vector<Document> FindTopDocuments(Policy policy,
                                          std::string_view raw_query,
                                          DocumentStatus status) const;
@@ -55,9 +91,43 @@ public:
   std::vector<Document> FindTopDocuments(Policy policy,
                                          std::string_view raw_query) const;
 
+  // Поиск с другой функцией ранжирования, например Bm25Scorer.
+  // По умолчанию используется TfIdfScorer.
+  template <typename Scorer>
+  std::vector<Document> FindTopDocuments(std::string_view raw_query,
+                                         const DocumentFilter &filter,
+                                         const Scorer &scorer) const;
+
+  // Поиск со сроком и отменой. По истечении срока или после отмены
+  // возвращаются лучшие из найденных к этому моменту документов.
+  // С MatchMode::ALL находятся только документы со всеми плюс-словами;
+  // для префикса (cat*) достаточно любого из его терминов. Опечатки в этом
+  // режиме не исправляются.
+  template <typename DocumentPredicate>
+  SearchResult FindTopDocuments(std::string_view raw_query,
+                                DocumentPredicate document_predicate,
+                                const SearchOptions &options) const;
+  SearchResult FindTopDocuments(std::string_view raw_query,
+                                const DocumentFilter &filter,
+                                const SearchOptions &options) const;
+  SearchResult FindTopDocuments(std::string_view raw_query,
+                                DocumentStatus status,
+                                const SearchOptions &options) const;
+
+  // Асинхронный поиск; сервер должен жить до получения результата
+  std::future<SearchResult>
+  FindTopDocumentsAsync(std::string raw_query, DocumentFilter filter,
+                        SearchOptions options = {}) const;
+
+  // План, по которому будет выполнен запрос без явной политики
+  QueryPlan ExplainQuery(std::string_view raw_query) const;
+
   // Количество документов в памяти
   int GetDocumentCount() const;
 
+  // Текст документа. Бросает std::out_of_range, если документа нет.
+  std::string GetDocumentText(int document_id) const;
+
   // Итерирование по id документов
   std::set<int>::const_iterator begin();
   std::set<int>::const_iterator end();
@@ -71,7 +141,49 @@ public:
   const std::map<std::string_view, double> &
   GetWordFrequencies(int document_id) const;
 
-  // Получаем документ по запросу
+  // Позиционный индекс для запросов с фразами в кавычках ("curly tail").
+  // Без него фраза разбирается как обычные плюс-слова. Минус-слова и
+  // префиксы (cat*) внутри фразы запрещены.
+  // При включении индекс строится по уже добавленным документам.
+  void EnablePositionalIndex(bool enable = true);
+  bool IsPositionalIndexEnabled() const;
+  // Память, занимаемая позиционным индексом, в байтах
+  size_t GetPositionalIndexMemoryUsage() const;
+
+  // Исправление опечаток: плюс-слово, которого нет в индексе, заменяется
+  // похожими терминами (не больше max_edits правок) с пониженным весом.
+  // 0 - выключено.
+  void SetTypoTolerance(int max_edits);
+  int GetTypoTolerance() const;
+
+  // Память, занимаемая структурами сервера
+  MemoryUsage GetMemoryUsage() const;
+  // Ограничение памяти. Если AddDocument его превысит, структуры сначала
+  // уплотняются, а если этого мало - бросается std::length_error,
+  // и сервер остаётся без изменений.
+  void SetMemoryBudget(std::optional<size_t> budget);
+  // Освобождение неиспользуемого резерва памяти
+  void Compact();
+
+  // Журнал упреждающей записи. Подключается только к пустому серверу:
+  // состояние восстанавливается из снимка и журнала, затем в журнал пишутся
+  // все изменения. Изменение попадает в журнал до изменения индекса; если
+  // запись не удалась, бросается исключение и сервер остаётся прежним.
+  // С wait_durable AddDocument и RemoveDocument возвращаются после записи
+  // изменения на диск, то есть каждая операция ждёт fdatasync; для
+  // загрузки многих документов есть AddDocuments. Без wait_durable записи попадают на диск группами не позже
+  // чем через commit_interval, а дождаться их можно SyncWriteAheadLog.
+  void AttachWriteAheadLog(
+      const std::string &path,
+      std::chrono::microseconds commit_interval = std::chrono::milliseconds(2),
+      bool wait_durable = true);
+  // Ожидание записи на диск всех изменений
+  void SyncWriteAheadLog();
+  // Снимок всех документов; журнал после него очищается
+  void Checkpoint();
+
+  // Получаем документ по запросу. Если документ содержит минус-слово или
+  // не содержит фразу запроса, список слов пустой.
   std::tuple<std::vector<std::string_view>, DocumentStatus>
   MatchDocument(std::string_view raw_query, int document_id) const;
   std::tuple<std::vector<std::string_view>, DocumentStatus>
@@ -81,17 +193,52 @@ public:
   MatchDocument(const std::execution::parallel_policy &,
                 std::string_view raw_query, int document_id) const;
 
+  // Получаем документы по запросу (запрос разбирается один раз)
+  std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+  MatchDocuments(std::string_view raw_query,
+                 const std::vector<int> &document_ids) const;
+  std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+  MatchDocuments(const std::execution::sequenced_policy &,
+                 std::string_view raw_query,
+                 const std::vector<int> &document_ids) const;
+  std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>
+  MatchDocuments(const std::execution::parallel_policy &,
+                 std::string_view raw_query,
+                 const std::vector<int> &document_ids) const;
+
 private:
+  // Проверка разбора запроса без выделения памяти, Tools/query_alloc_test.cpp
+  friend class QueryAllocTest;
+
   struct DocumentData {
     int rating;
     DocumentStatus status;
-    std::string data;
+    // Число слов без стоп-слов
+    uint32_t length;
+    DocumentStore::Handle text;
   };
   const std::set<std::string, std::less<>> stop_words_;
-  std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
+  TermDictionary terms_;
+  // Списки документов по id термина из terms_. Список термина без
+  // документов пуст, пока его id не достанется новому термину.
+  std::vector<std::map<int, Posting>> term_to_document_freqs_;
+  // Сумма длин документов для средней длины в BM25
+  uint64_t total_document_length_ = 0;
   std::map<int, DocumentData> documents_;
+  // Тексты документов хранятся сжатыми и нужны только для выдачи
+  DocumentStore document_store_;
   std::set<int> document_ids_;
   std::map<int, std::map<std::string_view, double>> id_to_document_freqs_;
+  bool positional_index_enabled_ = false;
+  std::map<std::string_view, std::map<int, PositionList>>
+      word_to_document_positions_;
+  std::map<DocumentStatus, DocumentBitmap> status_to_documents_;
+  std::map<int, DocumentBitmap> rating_to_documents_;
+  MemoryUsage memory_usage_;
+  std::optional<size_t> memory_budget_;
+  std::unique_ptr<WriteAheadLog> write_ahead_log_;
+  bool wait_durable_ = true;
+  int typo_tolerance_ = 0;
 
   // Проверка на стоп-слово
   bool IsStopWord(std::string_view word) const;
@@ -117,6 +264,7 @@ private:
     std::string_view data;
     bool is_minus;
     bool is_stop;
+    bool is_prefix;
   };
 
   QueryWord ParseQueryWord(std::string_view text) const;
@@ -124,21 +272,168 @@ private:
   struct Query {
     std::vector<std::string_view> plus_words;
     std::vector<std::string_view> minus_words;
+    // Слова всех фраз подряд; phrase_ends - границы фраз в phrase_words
+    std::vector<std::string_view> phrase_words;
+    std::vector<size_t> phrase_ends;
+    // Плюс-слова, заданные явно, без раскрытий префиксов и опечаток
+    std::vector<std::string_view> exact_words;
+    // Раскрытия префиксов плюс-слов подряд; prefix_ends - границы групп.
+    // Группа, в которую попало явное слово, им уже выполнена и не хранится.
+    std::vector<std::string_view> prefix_words;
+    std::vector<size_t> prefix_ends;
+    // Заполняется планировщиком: длины списков плюс-слов и оценка работы
+    std::vector<std::pair<size_t, std::string_view>> plus_postings;
+    size_t estimated_work = 0;
+    // Веса слов, подставленных вместо опечаток; у остальных вес 1
+    std::vector<std::pair<std::string_view, double>> word_weights;
+
+    double GetWeight(std::string_view word) const;
+    void Clear();
+  };
+
+  // Буферы разбора запроса. Берутся из пула текущего потока и возвращаются
+  // в него, поэтому в установившемся режиме разбор не выделяет память.
+  class QueryContext {
+  public:
+    QueryContext();
+    QueryContext(QueryContext &&other) = default;
+    QueryContext &operator=(QueryContext &&other) = delete;
+    ~QueryContext();
+
+    Query &operator*() const { return *query_; }
+    Query *operator->() const { return query_.get(); }
+
+  private:
+    std::unique_ptr<Query> query_;
+
+    // Пул буферов текущего потока
+    static std::vector<std::unique_ptr<Query>> &Pool();
   };
 
-  Query ParseQuery(std::string_view text, bool seq) const;
+  // Слова запроса отсортированы и без повторов. Префикс раскрывается
+  // не больше чем в MAX_PREFIX_EXPANSIONS встречающихся в документах терминов.
+  QueryContext ParseQuery(std::string_view text) const;
 
-  double ComputeWordInverseDocumentFreq(std::string_view &word) const;
+  // Добавляет к запросу замены ненайденных плюс-слов
+  void ExpandTypos(Query &query) const;
 
+  // Упорядочивает плюс-слова по длине списков; true, если запрос
+  // выгоднее выполнить параллельно
+  bool PlanQuery(Query &query) const;
+
+  // Документы, содержащие минус-слова
+  DocumentBitmap BuildExclusionBitmap(const Query &query) const;
+
+  CollectionStats GetCollectionStats() const;
+
+  // Список документов слова; nullptr, если слова нет ни в одном документе
+  const std::map<int, Posting> *FindPostings(std::string_view word) const;
+
+  template <typename Policy>
+  void RemoveDocumentFromIndex(Policy policy, int document_id);
+
+  // Проверка id и текста нового документа; возвращает его слова
+  std::vector<std::string_view>
+  SplitNewDocument(int document_id, std::string_view document) const;
+  // Добавление проверенного и записанного в журнал документа в индекс
+  void IndexDocument(int document_id, std::string_view document,
+                     DocumentStatus status, const std::vector<int> &ratings,
+                     std::vector<std::string_view> words);
+
+  // Оценка памяти под новый документ (с запасом)
+  size_t EstimateDocumentMemory(std::string_view document,
+                                const std::vector<std::string_view> &words) const;
+  // Проверка бюджета памяти перед добавлением
+  void ReserveMemory(size_t required);
+
+  static size_t PositionsMemory(const PositionList &positions);
+
+  // Заполнение и очистка позиционного индекса для документа
+  void AddDocumentPositions(int document_id,
+                            const std::vector<std::string_view> &words);
+  void RemoveDocumentPositions(int document_id);
+  void RemoveDocumentFilters(int document_id);
+
+  // Проверка фраз запроса по спискам позиций
+  bool MatchesPhrase(std::vector<std::string_view>::const_iterator first,
+                     std::vector<std::string_view>::const_iterator last,
+                     int document_id) const;
+  bool MatchesPhrases(const Query &query, int document_id) const;
+
+  // Пересечение отсортированных слов запроса с прямым индексом документа
+  std::tuple<std::vector<std::string_view>, DocumentStatus>
+  MatchParsedQuery(const Query &query, int document_id) const;
+
+  // Документы, проходящие фильтр. Фильтр только по статусу проверяется
+  // по набору индекса без копирования; новый набор строится, только когда
+  // нужно пересечь диапазон рейтингов.
+  struct FilterDocuments {
+    // nullptr, если статус не задан
+    const DocumentBitmap *status_documents = nullptr;
+    // Документы из диапазона рейтингов с учётом статуса
+    std::optional<DocumentBitmap> rated_documents;
+
+    bool Test(int document_id) const {
+      if (rated_documents) {
+        return rated_documents->Test(document_id);
+      }
+      return !status_documents || status_documents->Test(document_id);
+    }
+  };
+
+  FilterDocuments BuildFilterDocuments(const DocumentFilter &filter) const;
+
+  // Обёртка пользовательского предиката в проверку по id документа
   template <typename DocumentPredicate>
+  auto MakePredicateAcceptor(const DocumentPredicate &document_predicate) const;
+  // То же для фильтра; filter_documents должен жить до конца поиска
+  static auto MakeFilterAcceptor(const FilterDocuments &filter_documents);
+
+  // Поиск с автоматическим выбором политики по плану запроса.
+  // Если document_accept нельзя вызывать из нескольких потоков
+  // (пользовательский предикат), поиск всегда последовательный.
+  template <typename DocumentAcceptor, typename Scorer = TfIdfScorer>
   std::vector<Document>
-  FindAllDocuments(const Query &query,
-                   DocumentPredicate document_predicate) const;
+  FindPlannedDocuments(std::string_view raw_query,
+                       DocumentAcceptor document_accept,
+                       bool is_accept_thread_safe,
+                       const SearchBudget &budget = SearchBudget(),
+                       MatchMode match_mode = MatchMode::ANY,
+                       const Scorer &scorer = Scorer()) const;
 
-  template <typename DocumentPredicate, typename Policy>
+  template <typename Policy>
+  static void SelectTopDocuments(Policy policy,
+                                 std::vector<Document> &matched_documents);
+
+  template <typename DocumentAcceptor, typename Scorer = TfIdfScorer>
+  std::vector<Document>
+  FindAllDocuments(const Query &query, DocumentAcceptor document_accept,
+                   const SearchBudget &budget = SearchBudget(),
+                   const Scorer &scorer = Scorer()) const;
+
+  // Документы со всеми явными плюс-словами и хотя бы одним термином каждого
+  // префикса: пересечение, которое ведёт самое редкое условие.
+  // Релевантность та же, что у FindAllDocuments.
+  template <typename DocumentAcceptor, typename Scorer>
+  std::vector<Document>
+  FindDocumentsWithAllWords(const Query &query,
+                            DocumentAcceptor document_accept,
+                            const SearchBudget &budget,
+                            const Scorer &scorer) const;
+
+  // Первый документ списка с id не меньше document_id, начиная с position.
+  // Соседние документы проверяются подряд, дальние ищутся по дереву.
+  static std::map<int, Posting>::const_iterator
+  SkipTo(const std::map<int, Posting> &postings,
+         std::map<int, Posting>::const_iterator position, int document_id);
+
+  template <typename DocumentAcceptor, typename Policy,
+            typename Scorer = TfIdfScorer>
   std::vector<Document>
   FindAllDocuments(Policy policy, const Query &query,
-                   DocumentPredicate document_predicate) const;
+                   DocumentAcceptor document_accept,
+                   const SearchBudget &budget = SearchBudget(),
+                   const Scorer &scorer = Scorer()) const;
 };
 
 template <typename StringContainer>
@@ -153,45 +448,35 @@ template <typename DocumentPredicate>
 std::vector<Document>
 SearchServer::FindTopDocuments(std::string_view raw_query,
                                DocumentPredicate document_predicate) const {
-  const auto query = ParseQuery(raw_query, true);
-
-  auto matched_documents = FindAllDocuments(query, document_predicate);
-
-  sort(matched_documents.begin(), matched_documents.end(),
-       [](const Document &lhs, const Document &rhs) {
-         if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
-           return lhs.rating > rhs.rating;
-         } else {
-           return lhs.relevance > rhs.relevance;
-         }
-       });
-  if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-    matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-  }
-
-  return matched_documents;
+  return FindPlannedDocuments(
+      raw_query, MakePredicateAcceptor(document_predicate), false);
 }
 
 template <typename DocumentPredicate, typename Policy>
 std::vector<Document>
 SearchServer::FindTopDocuments(Policy policy, std::string_view raw_query,
                                DocumentPredicate document_predicate) const {
-  const auto query = ParseQuery(raw_query, true);
+  const auto query = ParseQuery(raw_query);
+  PlanQuery(*query);
+
+  auto matched_documents = FindAllDocuments(
+      policy, *query, MakePredicateAcceptor(document_predicate));
+  SelectTopDocuments(policy, matched_documents);
 
-  auto matched_documents = FindAllDocuments(policy, query, document_predicate);
+  return matched_documents;
+}
 
-  sort(policy, matched_documents.begin(), matched_documents.end(),
-       [](const Document &lhs, const Document &rhs) {
-         if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
-           return lhs.rating > rhs.rating;
-         } else {
-           return lhs.relevance > rhs.relevance;
-         }
-       });
+template <typename Policy>
+std::vector<Document>
+SearchServer::FindTopDocuments(Policy policy, std::string_view raw_query,
+                               const DocumentFilter &filter) const {
+  const auto query = ParseQuery(raw_query);
+  PlanQuery(*query);
 
-  if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-    matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-  }
+  const auto filter_documents = BuildFilterDocuments(filter);
+  auto matched_documents = FindAllDocuments(
+      policy, *query, MakeFilterAcceptor(filter_documents));
+  SelectTopDocuments(policy, matched_documents);
 
   return matched_documents;
 }
@@ -200,11 +485,7 @@ template <typename Policy>
 std::vector<Document>
 SearchServer::FindTopDocuments(Policy policy, std::string_view raw_query,
                                DocumentStatus status) const {
-  return FindTopDocuments(
-      policy, raw_query,
-      [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-      });
+  return FindTopDocuments(policy, raw_query, DocumentFilter(status));
 }
 
 template <typename Policy>
@@ -214,77 +495,319 @@ SearchServer::FindTopDocuments(Policy policy,
   return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
 }
 
+template <typename Scorer>
+std::vector<Document>
+SearchServer::FindTopDocuments(std::string_view raw_query,
+                               const DocumentFilter &filter,
+                               const Scorer &scorer) const {
+  const auto filter_documents = BuildFilterDocuments(filter);
+  return FindPlannedDocuments(raw_query, MakeFilterAcceptor(filter_documents),
+                              true, SearchBudget(), MatchMode::ANY, scorer);
+}
+
+template <typename DocumentPredicate>
+SearchResult
+SearchServer::FindTopDocuments(std::string_view raw_query,
+                               DocumentPredicate document_predicate,
+                               const SearchOptions &options) const {
+  const SearchBudget budget(options);
+  auto matched_documents =
+      FindPlannedDocuments(raw_query, MakePredicateAcceptor(document_predicate),
+                           false, budget, options.match_mode);
+  return {std::move(matched_documents), !budget.WasExhausted()};
+}
+
+template <typename DocumentAcceptor, typename Scorer>
+std::vector<Document>
+SearchServer::FindPlannedDocuments(std::string_view raw_query,
+                                   DocumentAcceptor document_accept,
+                                   bool is_accept_thread_safe,
+                                   const SearchBudget &budget,
+                                   MatchMode match_mode,
+                                   const Scorer &scorer) const {
+  const auto query = ParseQuery(raw_query);
+
+  std::vector<Document> matched_documents;
+  if (match_mode == MatchMode::ALL) {
+    // Пересечение ведёт самый короткий список, делить его по потокам незачем
+    PlanQuery(*query);
+    matched_documents =
+        FindDocumentsWithAllWords(*query, document_accept, budget, scorer);
+    SelectTopDocuments(std::execution::seq, matched_documents);
+  } else if (PlanQuery(*query) && is_accept_thread_safe) {
+    matched_documents = FindAllDocuments(std::execution::par, *query,
+                                         document_accept, budget, scorer);
+    SelectTopDocuments(std::execution::par, matched_documents);
+  } else {
+    matched_documents =
+        FindAllDocuments(*query, document_accept, budget, scorer);
+    SelectTopDocuments(std::execution::seq, matched_documents);
+  }
+  return matched_documents;
+}
+
+template <typename Policy>
+void SearchServer::SelectTopDocuments(
+    Policy policy, std::vector<Document> &matched_documents) {
+  // Полностью упорядочивать нужно только первые документы: после прерванного
+  // поиска их может быть очень много
+  const auto top_end =
+      matched_documents.begin() +
+      std::min<size_t>(matched_documents.size(), MAX_RESULT_DOCUMENT_COUNT);
+  partial_sort(policy, matched_documents.begin(), top_end,
+               matched_documents.end(),
+               [](const Document &lhs, const Document &rhs) {
+                 if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
+                   return lhs.rating > rhs.rating;
+                 } else {
+                   return lhs.relevance > rhs.relevance;
+                 }
+               });
+  matched_documents.erase(top_end, matched_documents.end());
+}
+
 template <typename DocumentPredicate>
+auto SearchServer::MakePredicateAcceptor(
+    const DocumentPredicate &document_predicate) const {
+  return [this, &document_predicate](int document_id) {
+    const auto &document_data = documents_.at(document_id);
+    return document_predicate(document_id, document_data.status,
+                              document_data.rating);
+  };
+}
+
+inline auto
+SearchServer::MakeFilterAcceptor(const FilterDocuments &filter_documents) {
+  return [&filter_documents](int document_id) {
+    return filter_documents.Test(document_id);
+  };
+}
+
+template <typename DocumentAcceptor, typename Scorer>
 std::vector<Document>
 SearchServer::FindAllDocuments(const Query &query,
-                               DocumentPredicate document_predicate) const {
+                               DocumentAcceptor document_accept,
+                               const SearchBudget &budget,
+                               const Scorer &scorer) const {
+  const auto excluded_documents = BuildExclusionBitmap(query);
+  const CollectionStats stats = GetCollectionStats();
+
   std::map<int, double> document_to_relevance;
+  size_t scanned = 0;
   for (std::string_view word : query.plus_words) {
-    if (word_to_document_freqs_.count(word) == 0) {
+    if (budget.Exhausted()) {
+      break;
+    }
+    const auto *postings = FindPostings(word);
+    if (!postings) {
       continue;
     }
-    const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-    for (const auto [document_id, term_freq] :
-         word_to_document_freqs_.at(word)) {
-      const auto &document_data = documents_.at(document_id);
-      if (document_predicate(document_id, document_data.status,
-                             document_data.rating)) {
-        document_to_relevance[document_id] += term_freq * inverse_document_freq;
+    const auto score = scorer.ForTerm(stats, postings->size());
+    const double weight = query.GetWeight(word);
+    for (const auto &[document_id, posting] : *postings) {
+      if (budget.IsLimited() && ++scanned % SearchBudget::CHECK_INTERVAL == 0 &&
+          budget.Exhausted()) {
+        break;
+      }
+      if (!excluded_documents.Test(document_id) &&
+          document_accept(document_id)) {
+        document_to_relevance[document_id] += score(posting) * weight;
       }
     }
   }
 
-  for (std::string_view word : query.minus_words) {
-    if (word_to_document_freqs_.count(word) == 0) {
+  std::vector<Document> matched_documents;
+  for (const auto [document_id, relevance] : document_to_relevance) {
+    if (!MatchesPhrases(query, document_id)) {
       continue;
     }
-    for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-      document_to_relevance.erase(document_id);
+    matched_documents.push_back(
+        {document_id, relevance, documents_.at(document_id).rating});
+  }
+  return matched_documents;
+}
+
+template <typename DocumentAcceptor, typename Scorer>
+std::vector<Document>
+SearchServer::FindDocumentsWithAllWords(const Query &query,
+                                        DocumentAcceptor document_accept,
+                                        const SearchBudget &budget,
+                                        const Scorer &scorer) const {
+  // Списки терминов всех условий и их текущие позиции
+  std::vector<const std::map<int, Posting> *> postings;
+  // Условие - диапазон терминов, из которых в документе должен быть хотя бы
+  // один: явное слово или раскрытый префикс. Упорядочены по числу документов.
+  struct Condition {
+    size_t document_count;
+    size_t begin;
+    size_t end;
+  };
+  std::vector<Condition> conditions;
+  const auto add_term = [this, &postings](std::string_view word) {
+    const auto *word_postings = FindPostings(word);
+    if (!word_postings) {
+      return size_t{0};
+    }
+    postings.push_back(word_postings);
+    return word_postings->size();
+  };
+
+  // Замены опечаток необязательны и в пересечение не входят
+  for (std::string_view word : query.exact_words) {
+    const size_t document_count = add_term(word);
+    if (document_count == 0) {
+      return {};
+    }
+    conditions.push_back({document_count, postings.size() - 1, postings.size()});
+  }
+  size_t group_begin = 0;
+  for (const size_t group_end : query.prefix_ends) {
+    Condition condition{0, postings.size(), 0};
+    for (size_t i = group_begin; i < group_end; ++i) {
+      condition.document_count += add_term(query.prefix_words[i]);
+    }
+    condition.end = postings.size();
+    if (condition.begin == condition.end) {
+      return {};
+    }
+    conditions.push_back(condition);
+    group_begin = group_end;
+  }
+  if (conditions.empty()) {
+    return {};
+  }
+  std::sort(conditions.begin(), conditions.end(),
+            [](const Condition &lhs, const Condition &rhs) {
+              return lhs.document_count < rhs.document_count;
+            });
+
+  // Условия только отбирают документы. Релевантность, как в
+  // FindAllDocuments, складывается по плюс-словам: каждый термин
+  // учитывается один раз, замены опечаток - со своим весом.
+  const CollectionStats stats = GetCollectionStats();
+  std::vector<const std::map<int, Posting> *> scored_postings;
+  std::vector<decltype(scorer.ForTerm(stats, 0))> scores;
+  std::vector<double> weights;
+  for (std::string_view word : query.plus_words) {
+    const auto *word_postings = FindPostings(word);
+    if (word_postings) {
+      scored_postings.push_back(word_postings);
+      scores.push_back(scorer.ForTerm(stats, word_postings->size()));
+      weights.push_back(query.GetWeight(word));
     }
   }
 
+  const auto excluded_documents = BuildExclusionBitmap(query);
+  std::vector<std::map<int, Posting>::const_iterator> positions;
+  for (const auto *term_postings : postings) {
+    positions.push_back(term_postings->begin());
+  }
+  std::vector<std::map<int, Posting>::const_iterator> scored_positions;
+  for (const auto *term_postings : scored_postings) {
+    scored_positions.push_back(term_postings->begin());
+  }
+
   std::vector<Document> matched_documents;
-  for (const auto [document_id, relevance] : document_to_relevance) {
+  const Condition &leader = conditions[0];
+  size_t scanned = 0;
+  while (true) {
+    if (budget.IsLimited() && ++scanned % SearchBudget::CHECK_INTERVAL == 0 &&
+        budget.Exhausted()) {
+      break;
+    }
+    // Следующий документ самого редкого условия: слияние его списков
+    std::optional<int> document_id;
+    for (size_t i = leader.begin; i < leader.end; ++i) {
+      if (positions[i] != postings[i]->end() &&
+          (!document_id || positions[i]->first < *document_id)) {
+        document_id = positions[i]->first;
+      }
+    }
+    if (!document_id) {
+      break;
+    }
+    for (size_t i = leader.begin; i < leader.end; ++i) {
+      if (positions[i] != postings[i]->end() &&
+          positions[i]->first == *document_id) {
+        ++positions[i];
+      }
+    }
+
+    bool has_all_words = true;
+    for (size_t c = 1; c < conditions.size() && has_all_words; ++c) {
+      bool has_word = false;
+      bool is_exhausted = true;
+      for (size_t i = conditions[c].begin; i < conditions[c].end; ++i) {
+        positions[i] = SkipTo(*postings[i], positions[i], *document_id);
+        if (positions[i] == postings[i]->end()) {
+          continue;
+        }
+        is_exhausted = false;
+        has_word = has_word || positions[i]->first == *document_id;
+      }
+      if (is_exhausted) {
+        // В более длинных списках документов с большими id не осталось
+        return matched_documents;
+      }
+      has_all_words = has_word;
+    }
+    if (!has_all_words || excluded_documents.Test(*document_id) ||
+        !document_accept(*document_id) ||
+        !MatchesPhrases(query, *document_id)) {
+      continue;
+    }
+    double relevance = 0.0;
+    for (size_t i = 0; i < scored_postings.size(); ++i) {
+      scored_positions[i] =
+          SkipTo(*scored_postings[i], scored_positions[i], *document_id);
+      if (scored_positions[i] != scored_postings[i]->end() &&
+          scored_positions[i]->first == *document_id) {
+        relevance += scores[i](scored_positions[i]->second) * weights[i];
+      }
+    }
     matched_documents.push_back(
-        {document_id, relevance, documents_.at(document_id).rating});
+        {*document_id, relevance, documents_.at(*document_id).rating});
   }
   return matched_documents;
 }
 
-template <typename DocumentPredicate, typename Policy>
+template <typename DocumentAcceptor, typename Policy, typename Scorer>
 std::vector<Document>
 SearchServer::FindAllDocuments(Policy policy, const Query &query,
-                               DocumentPredicate document_predicate) const {
+                               DocumentAcceptor document_accept,
+                               const SearchBudget &budget,
+                               const Scorer &scorer) const {
+  const auto excluded_documents = BuildExclusionBitmap(query);
+  const CollectionStats stats = GetCollectionStats();
+
   const size_t par_for_con_map = 100;
   ConcurrentMap<int, double> document_to_relevance(par_for_con_map);
 
   std::for_each(policy, query.plus_words.begin(), query.plus_words.end(),
-                [this, &document_predicate,
+                [this, &query, &scorer, &stats, &document_accept,
+                 &excluded_documents, &budget,
                  &document_to_relevance](std::string_view word) {
-                  if (word_to_document_freqs_.count(word) == 0) {
+                  if (budget.Exhausted()) {
                     return;
                   }
-                  const double inverse_document_freq =
-                      ComputeWordInverseDocumentFreq(word);
-                  for (const auto [document_id, term_freq] :
-                       word_to_document_freqs_.at(word)) {
-                    const auto &document_data = documents_.at(document_id);
-                    if (document_predicate(document_id, document_data.status,
-                                           document_data.rating)) {
-                      document_to_relevance[document_id].ref_to_value +=
-                          term_freq * inverse_document_freq;
-                    }
-                  }
-                });
-
-  std::for_each(policy, query.minus_words.begin(), query.minus_words.end(),
-                [&](std::string_view word) {
-                  if (word_to_document_freqs_.count(word) == 0) {
+                  const auto *postings = FindPostings(word);
+                  if (!postings) {
                     return;
                   }
-                  for (const auto [document_id, _] :
-                       word_to_document_freqs_.at(word)) {
-                    document_to_relevance.erase(document_id);
+                  const auto score = scorer.ForTerm(stats, postings->size());
+                  const double weight = query.GetWeight(word);
+                  size_t scanned = 0;
+                  for (const auto &[document_id, posting] : *postings) {
+                    if (budget.IsLimited() &&
+                        ++scanned % SearchBudget::CHECK_INTERVAL == 0 &&
+                        budget.Exhausted()) {
+                      return;
+                    }
+                    if (!excluded_documents.Test(document_id) &&
+                        document_accept(document_id)) {
+                      document_to_relevance[document_id].ref_to_value +=
+                          score(posting) * weight;
+                    }
                   }
                 });
 
@@ -293,6 +816,9 @@ SearchServer::FindAllDocuments(Policy policy, const Query &query,
 
   std::vector<Document> matched_documents;
   for (const auto [document_id, relevance] : document_to_relevance_whole) {
+    if (!MatchesPhrases(query, document_id)) {
+      continue;
+    }
     matched_documents.push_back(
         {document_id, relevance, documents_.at(document_id).rating});
   }
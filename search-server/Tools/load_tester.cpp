@@ -0,0 +1,379 @@
+// Нагрузочное тестирование: воспроизведение журнала запросов.
+//
+// Сборка (из каталога search-server):
+//   g++ -std=c++17 -O2 Tools/load_tester.cpp Utility/*.cpp -ltbb -lpthread
+//       -o load_tester
+//
+// Запуск:
+//   load_tester --documents docs.txt --trace trace.txt [--stop-words "a the"]
+//               [--qps 1000] [--threads 4] [--requests N] [--batch 32]
+//               [--mode seq|par|auto|batch|all]
+//
+// docs.txt - по документу в строке, id документа - номер строки.
+// trace.txt - по запросу в строке. Строки "!add <id> <текст>" и
+// "!remove <id>" изменяют индекс вперемешку с запросами.
+//
+// Нагрузка открытая: запрос i поступает в момент start + i / qps независимо
+// от того, успел ли сервер ответить на предыдущие. Задержка считается от
+// запланированного момента, а не от фактического начала обработки, поэтому
+// очередь перед перегруженным сервером попадает в перцентили (поправка на
+// coordinated omission). Время обработки выводится отдельно.
+
+#include "../Search_server/process_queries.cpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std::string_literals;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Mode { SEQ, PAR, AUTO, BATCH };
+
+struct Options {
+  std::string documents_path;
+  std::string trace_path;
+  std::string stop_words;
+  double qps = 1000;
+  int threads = 4;
+  size_t requests = 0;
+  size_t batch = 32;
+  std::vector<Mode> modes = {Mode::SEQ, Mode::PAR, Mode::AUTO, Mode::BATCH};
+};
+
+struct Request {
+  enum class Type { QUERY, ADD, REMOVE };
+
+  Type type = Type::QUERY;
+  int document_id = 0;
+  std::string text;
+};
+
+struct RunResult {
+  // Задержка от запланированного момента и время обработки, в наносекундах
+  std::vector<int64_t> latencies;
+  std::vector<int64_t> service_times;
+  size_t errors = 0;
+  Clock::duration elapsed{};
+};
+
+std::string_view ModeName(Mode mode) {
+  switch (mode) {
+  case Mode::SEQ:
+    return "seq";
+  case Mode::PAR:
+    return "par";
+  case Mode::AUTO:
+    return "auto";
+  case Mode::BATCH:
+    return "batch";
+  }
+  return "unknown";
+}
+
+std::vector<Mode> ParseModes(std::string_view text) {
+  if (text == "all") {
+    return {Mode::SEQ, Mode::PAR, Mode::AUTO, Mode::BATCH};
+  }
+  for (Mode mode : {Mode::SEQ, Mode::PAR, Mode::AUTO, Mode::BATCH}) {
+    if (text == ModeName(mode)) {
+      return {mode};
+    }
+  }
+  throw std::invalid_argument("Unknown mode "s + std::string(text));
+}
+
+Options ParseOptions(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view name = argv[i];
+    if (i + 1 == argc) {
+      throw std::invalid_argument("No value for "s + std::string(name));
+    }
+    const std::string value = argv[++i];
+    if (name == "--documents") {
+      options.documents_path = value;
+    } else if (name == "--trace") {
+      options.trace_path = value;
+    } else if (name == "--stop-words") {
+      options.stop_words = value;
+    } else if (name == "--qps") {
+      options.qps = std::stod(value);
+    } else if (name == "--threads") {
+      options.threads = std::stoi(value);
+    } else if (name == "--requests") {
+      options.requests = std::stoul(value);
+    } else if (name == "--batch") {
+      options.batch = std::stoul(value);
+    } else if (name == "--mode") {
+      options.modes = ParseModes(value);
+    } else {
+      throw std::invalid_argument("Unknown option "s + std::string(name));
+    }
+  }
+  if (options.documents_path.empty() || options.trace_path.empty()) {
+    throw std::invalid_argument("--documents and --trace are required"s);
+  }
+  if (options.qps <= 0 || options.threads <= 0 || options.batch == 0) {
+    throw std::invalid_argument("--qps, --threads and --batch must be positive"s);
+  }
+  return options;
+}
+
+std::vector<std::string> ReadLines(const std::string &path) {
+  std::ifstream input(path);
+  if (!input) {
+    throw std::runtime_error("Cannot open "s + path);
+  }
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(input, line);) {
+    lines.push_back(std::move(line));
+  }
+  return lines;
+}
+
+std::vector<Request> ReadTrace(const std::string &path) {
+  std::vector<Request> trace;
+  for (std::string &line : ReadLines(path)) {
+    Request request;
+    std::istringstream fields(line);
+    std::string command;
+    fields >> command;
+    if (command == "!add") {
+      request.type = Request::Type::ADD;
+      fields >> request.document_id >> std::ws;
+      std::getline(fields, request.text);
+    } else if (command == "!remove") {
+      request.type = Request::Type::REMOVE;
+      fields >> request.document_id;
+    } else {
+      request.text = std::move(line);
+    }
+    if (!fields && request.type != Request::Type::QUERY) {
+      throw std::invalid_argument("Bad trace line: "s + line);
+    }
+    trace.push_back(std::move(request));
+  }
+  if (trace.empty()) {
+    throw std::invalid_argument("Trace is empty"s);
+  }
+  return trace;
+}
+
+void FindDocuments(const SearchServer &search_server, Mode mode,
+                   const std::string &query) {
+  switch (mode) {
+  case Mode::SEQ:
+    search_server.FindTopDocuments(std::execution::seq, query);
+    break;
+  case Mode::PAR:
+    search_server.FindTopDocuments(std::execution::par, query);
+    break;
+  default:
+    search_server.FindTopDocuments(query);
+    break;
+  }
+}
+
+// Изменения индекса выполняются под эксклюзивной блокировкой,
+// запросы - под разделяемой
+bool ApplyMutation(SearchServer &search_server, std::shared_mutex &mutex,
+                   const Request &request) {
+  std::unique_lock lock(mutex);
+  try {
+    if (request.type == Request::Type::ADD) {
+      search_server.AddDocument(request.document_id, request.text,
+                                DocumentStatus::ACTUAL, {});
+    } else {
+      search_server.RemoveDocument(request.document_id);
+    }
+  } catch (const std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+RunResult Run(const Options &options, Mode mode,
+              const std::vector<std::string> &documents,
+              const std::vector<Request> &trace) {
+  // Для каждого режима индекс строится заново, чтобы изменения из журнала
+  // не влияли на следующий прогон
+  SearchServer search_server(options.stop_words);
+  for (size_t i = 0; i < documents.size(); ++i) {
+    search_server.AddDocument(static_cast<int>(i + 1), documents[i],
+                              DocumentStatus::ACTUAL, {});
+  }
+  std::shared_mutex mutex;
+
+  const size_t request_count =
+      options.requests == 0 ? trace.size() : options.requests;
+  const auto interval = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / options.qps));
+  const size_t unit = mode == Mode::BATCH ? options.batch : 1;
+  // Потоки берут запросы по порядку; в пакетном режиме - сразу пакет
+  std::atomic<size_t> next_request = 0;
+  std::vector<RunResult> thread_results(options.threads);
+  const auto start = Clock::now() + std::chrono::milliseconds(10);
+
+  const auto worker = [&](RunResult &result) {
+    std::vector<std::string> batch;
+    for (;;) {
+      const size_t first = next_request.fetch_add(unit);
+      if (first >= request_count) {
+        return;
+      }
+      const size_t last = std::min(first + unit, request_count);
+      const auto scheduled = [&](size_t i) {
+        return start + interval * static_cast<Clock::rep>(i);
+      };
+      const auto record = [&](size_t i, Clock::time_point began) {
+        const auto now = Clock::now();
+        result.latencies.push_back((now - scheduled(i)).count());
+        result.service_times.push_back((now - began).count());
+      };
+
+      // Пакет отправляется, когда поступил последний его запрос;
+      // изменения индекса разрывают пакет
+      size_t i = first;
+      while (i < last) {
+        const Request &request = trace[i % trace.size()];
+        if (request.type != Request::Type::QUERY) {
+          std::this_thread::sleep_until(scheduled(i));
+          const auto began = Clock::now();
+          if (!ApplyMutation(search_server, mutex, request)) {
+            ++result.errors;
+          }
+          record(i, began);
+          ++i;
+          continue;
+        }
+        if (mode != Mode::BATCH) {
+          std::this_thread::sleep_until(scheduled(i));
+          const auto began = Clock::now();
+          try {
+            std::shared_lock lock(mutex);
+            FindDocuments(search_server, mode, request.text);
+          } catch (const std::exception &) {
+            ++result.errors;
+          }
+          record(i, began);
+          ++i;
+          continue;
+        }
+
+        batch.clear();
+        size_t batch_end = i;
+        while (batch_end < last &&
+               trace[batch_end % trace.size()].type == Request::Type::QUERY) {
+          batch.push_back(trace[batch_end % trace.size()].text);
+          ++batch_end;
+        }
+        std::this_thread::sleep_until(scheduled(batch_end - 1));
+        const auto began = Clock::now();
+        try {
+          std::shared_lock lock(mutex);
+          ProcessQueries(search_server, batch);
+        } catch (const std::exception &) {
+          result.errors += batch.size();
+        }
+        for (; i < batch_end; ++i) {
+          record(i, began);
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (RunResult &result : thread_results) {
+    threads.emplace_back(worker, std::ref(result));
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  RunResult total;
+  total.elapsed = Clock::now() - start;
+  for (RunResult &result : thread_results) {
+    total.latencies.insert(total.latencies.end(), result.latencies.begin(),
+                           result.latencies.end());
+    total.service_times.insert(total.service_times.end(),
+                               result.service_times.begin(),
+                               result.service_times.end());
+    total.errors += result.errors;
+  }
+  return total;
+}
+
+// Перцентиль по ближайшему рангу, в микросекундах
+double Percentile(const std::vector<int64_t> &sorted_values, double fraction) {
+  if (sorted_values.empty()) {
+    return 0;
+  }
+  const size_t rank = static_cast<size_t>(
+      std::ceil(fraction * static_cast<double>(sorted_values.size())));
+  const size_t index = std::min(rank == 0 ? 0 : rank - 1,
+                                sorted_values.size() - 1);
+  return std::chrono::duration<double, std::micro>(
+             Clock::duration(sorted_values[index]))
+      .count();
+}
+
+void PrintResult(std::ostream &output, const Options &options, Mode mode,
+                 RunResult &result) {
+  std::sort(result.latencies.begin(), result.latencies.end());
+  std::sort(result.service_times.begin(), result.service_times.end());
+  const double seconds =
+      std::chrono::duration<double>(result.elapsed).count();
+  const double throughput = result.latencies.size() / seconds;
+
+  output << std::fixed << std::setprecision(1);
+  output << ModeName(mode) << ": "s << result.latencies.size()
+         << " requests, "s << result.errors << " errors, "s << throughput
+         << " req/s"s;
+  if (throughput < options.qps * 0.95) {
+    output << " (target "s << options.qps << " not reached)"s;
+  }
+  output << "\n  latency, us: p50 "s << Percentile(result.latencies, 0.5)
+         << ", p90 "s << Percentile(result.latencies, 0.9) << ", p99 "s
+         << Percentile(result.latencies, 0.99) << ", p99.9 "s
+         << Percentile(result.latencies, 0.999) << ", max "s
+         << Percentile(result.latencies, 1.0);
+  output << "\n  service, us: p50 "s << Percentile(result.service_times, 0.5)
+         << ", p99 "s << Percentile(result.service_times, 0.99) << ", max "s
+         << Percentile(result.service_times, 1.0) << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    const Options options = ParseOptions(argc, argv);
+    const auto documents = ReadLines(options.documents_path);
+    const auto trace = ReadTrace(options.trace_path);
+    std::cout << documents.size() << " documents, "s << trace.size()
+              << " trace lines, "s << options.threads << " threads, "s
+              << options.qps << " qps"s << std::endl;
+    for (Mode mode : options.modes) {
+      auto result = Run(options, mode, documents, trace);
+      PrintResult(std::cout, options, mode, result);
+    }
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,84 @@
+// Проверка: разбор и планирование запроса в установившемся режиме
+// не выделяют память (буферы берутся из пула потока).
+//
+// Сборка (из каталога search-server):
+//   g++ -std=c++17 -O2 Tools/query_alloc_test.cpp Utility/*.cpp -ltbb
+//       -lpthread -o query_alloc_test
+//
+// Программа подменяет глобальный operator new счётчиком, поэтому
+// собирать её с санитайзерами адресов нельзя. Код возврата 1 - если
+// разбор выделил память.
+
+#include "../Search_server/process_queries.cpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std::string_literals;
+
+namespace {
+
+size_t allocation_count = 0;
+
+} // namespace
+
+void *operator new(std::size_t size) {
+  ++allocation_count;
+  if (void *memory = std::malloc(size == 0 ? 1 : size)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+
+void operator delete(void *memory, std::size_t) noexcept {
+  std::free(memory);
+}
+
+class QueryAllocTest {
+public:
+  // Число выделений памяти на repeat разборов уже прогретого запроса
+  static size_t CountAllocations(const SearchServer &server,
+                                 std::string_view raw_query, int repeat) {
+    // Первые разборы заполняют пул и резервируют буферы
+    for (int i = 0; i < 3; ++i) {
+      const auto query = server.ParseQuery(raw_query);
+      server.PlanQuery(*query);
+    }
+    const size_t before = allocation_count;
+    for (int i = 0; i < repeat; ++i) {
+      const auto query = server.ParseQuery(raw_query);
+      server.PlanQuery(*query);
+    }
+    return allocation_count - before;
+  }
+};
+
+int main() {
+  SearchServer server("and with"s);
+  server.EnablePositionalIndex();
+  const std::vector<std::string> documents = {
+      "white cat and yellow hat"s, "curly cat curly tail"s,
+      "nasty dog with big eyes"s, "nasty pigeon john"s};
+  for (size_t i = 0; i < documents.size(); ++i) {
+    server.AddDocument(static_cast<int>(i) + 1, documents[i],
+                       DocumentStatus::ACTUAL, {1, 2});
+  }
+
+  const std::vector<std::string> queries = {
+      "curly cat"s, "curly -dog \"cat tail\" ca* nasty cat curly"s,
+      "-nasty* white and hat"s};
+  bool ok = true;
+  for (const std::string &query : queries) {
+    const size_t allocations =
+        QueryAllocTest::CountAllocations(server, query, 1000);
+    std::cout << query << ": "s << allocations << " allocations"s
+              << std::endl;
+    ok = ok && allocations == 0;
+  }
+  return ok ? 0 : 1;
+}
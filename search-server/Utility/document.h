@@ -1,6 +1,9 @@
 #pragma once
 
 #include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
 
 enum class DocumentStatus {
   ACTUAL,
@@ -9,6 +12,23 @@ enum class DocumentStatus {
   REMOVED,
 };
 
+// Фильтр по статусу и диапазону рейтинга (границы включительно).
+// Вычисляется через битовые наборы индекса, без вызова предиката
+// для каждого документа.
+struct DocumentFilter {
+  DocumentFilter() = default;
+
+  DocumentFilter(DocumentStatus status) : status(status) {}
+
+  DocumentFilter(std::optional<DocumentStatus> status,
+                 std::optional<int> min_rating, std::optional<int> max_rating)
+      : status(status), min_rating(min_rating), max_rating(max_rating) {}
+
+  std::optional<DocumentStatus> status;
+  std::optional<int> min_rating;
+  std::optional<int> max_rating;
+};
+
 struct Document {
   Document() = default;
 
@@ -19,3 +39,11 @@ struct Document {
   double relevance = 0.0;
   int rating = 0;
 };
+
+// Документ для пакетного добавления; текст копируется при добавлении
+struct NewDocument {
+  int id = 0;
+  std::string_view text;
+  DocumentStatus status = DocumentStatus::ACTUAL;
+  std::vector<int> ratings;
+};
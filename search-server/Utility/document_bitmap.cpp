@@ -0,0 +1,219 @@
+#include "document_bitmap.h"
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <iterator>
+
+void DocumentBitmap::Set(int document_id) {
+  const uint32_t id = static_cast<uint32_t>(document_id);
+  Block &block = blocks_[id >> BLOCK_BITS];
+  const uint32_t count = block.count;
+  block.Set(static_cast<uint16_t>(id & LOW_MASK));
+  count_ += block.count - count;
+}
+
+void DocumentBitmap::Reset(int document_id) {
+  const uint32_t id = static_cast<uint32_t>(document_id);
+  const auto block = blocks_.find(id >> BLOCK_BITS);
+  if (block == blocks_.end()) {
+    return;
+  }
+  const uint32_t count = block->second.count;
+  block->second.Reset(static_cast<uint16_t>(id & LOW_MASK));
+  count_ -= count - block->second.count;
+  if (block->second.count == 0) {
+    blocks_.erase(block);
+  }
+}
+
+bool DocumentBitmap::Test(int document_id) const {
+  const uint32_t id = static_cast<uint32_t>(document_id);
+  const auto block = blocks_.find(id >> BLOCK_BITS);
+  return block != blocks_.end() &&
+         block->second.Test(static_cast<uint16_t>(id & LOW_MASK));
+}
+
+DocumentBitmap &DocumentBitmap::operator&=(const DocumentBitmap &other) {
+  auto other_block = other.blocks_.begin();
+  count_ = 0;
+  for (auto block = blocks_.begin(); block != blocks_.end();) {
+    while (other_block != other.blocks_.end() &&
+           other_block->first < block->first) {
+      ++other_block;
+    }
+    if (other_block == other.blocks_.end() ||
+        other_block->first != block->first) {
+      block = blocks_.erase(block);
+      continue;
+    }
+    block->second.IntersectWith(other_block->second);
+    count_ += block->second.count;
+    block = block->second.count == 0 ? blocks_.erase(block) : std::next(block);
+  }
+  return *this;
+}
+
+DocumentBitmap &DocumentBitmap::operator|=(const DocumentBitmap &other) {
+  auto hint = blocks_.begin();
+  for (const auto &[key, other_block] : other.blocks_) {
+    while (hint != blocks_.end() && hint->first < key) {
+      ++hint;
+    }
+    if (hint == blocks_.end() || hint->first != key) {
+      blocks_.emplace_hint(hint, key, other_block);
+      count_ += other_block.count;
+      continue;
+    }
+    const uint32_t count = hint->second.count;
+    hint->second.UniteWith(other_block);
+    count_ += hint->second.count - count;
+  }
+  return *this;
+}
+
+void DocumentBitmap::ShrinkToFit() {
+  for (auto &[_, block] : blocks_) {
+    block.values.shrink_to_fit();
+  }
+}
+
+size_t DocumentBitmap::MemoryUsage() const {
+  size_t usage = sizeof(*this);
+  for (const auto &[_, block] : blocks_) {
+    usage += TREE_NODE_SIZE<std::pair<const uint32_t, Block>> +
+             block.words.capacity() * sizeof(uint64_t) +
+             block.values.capacity() * sizeof(uint16_t);
+  }
+  return usage;
+}
+
+bool DocumentBitmap::Block::Test(uint16_t low) const {
+  if (IsBitmap()) {
+    return words[low / 64] >> (low % 64) & 1;
+  }
+  return std::binary_search(values.begin(), values.end(), low);
+}
+
+void DocumentBitmap::Block::Set(uint16_t low) {
+  if (IsBitmap()) {
+    const uint64_t bit = uint64_t(1) << (low % 64);
+    if (!(words[low / 64] & bit)) {
+      words[low / 64] |= bit;
+      ++count;
+    }
+    return;
+  }
+  // id обычно растут, поэтому чаще всего значение дописывается в конец
+  const auto it = (values.empty() || values.back() < low)
+                      ? values.end()
+                      : std::lower_bound(values.begin(), values.end(), low);
+  if (it != values.end() && *it == low) {
+    return;
+  }
+  values.insert(it, low);
+  ++count;
+  if (values.size() > ARRAY_LIMIT) {
+    ToBitmap();
+  }
+}
+
+void DocumentBitmap::Block::Reset(uint16_t low) {
+  if (IsBitmap()) {
+    const uint64_t bit = uint64_t(1) << (low % 64);
+    if (words[low / 64] & bit) {
+      words[low / 64] &= ~bit;
+      --count;
+      // Запас в половину порога не даёт блоку переключаться туда и обратно
+      if (count < ARRAY_LIMIT / 2) {
+        ToArray();
+      }
+    }
+    return;
+  }
+  const auto it = std::lower_bound(values.begin(), values.end(), low);
+  if (it != values.end() && *it == low) {
+    values.erase(it);
+    --count;
+  }
+}
+
+void DocumentBitmap::Block::IntersectWith(const Block &other) {
+  if (IsBitmap() && other.IsBitmap()) {
+    count = 0;
+    for (size_t i = 0; i < BITMAP_WORDS; ++i) {
+      words[i] &= other.words[i];
+      count += __builtin_popcountll(words[i]);
+    }
+    if (count <= ARRAY_LIMIT) {
+      ToArray();
+    }
+    return;
+  }
+  if (IsBitmap()) {
+    // Результат не больше массива other
+    std::vector<uint16_t> result;
+    result.reserve(other.values.size());
+    for (uint16_t low : other.values) {
+      if (Test(low)) {
+        result.push_back(low);
+      }
+    }
+    words = std::vector<uint64_t>();
+    values = std::move(result);
+  } else {
+    values.erase(std::remove_if(values.begin(), values.end(),
+                                [&other](uint16_t low) {
+                                  return !other.Test(low);
+                                }),
+                 values.end());
+  }
+  count = static_cast<uint32_t>(values.size());
+}
+
+void DocumentBitmap::Block::UniteWith(const Block &other) {
+  if (!IsBitmap() && !other.IsBitmap()) {
+    std::vector<uint16_t> result;
+    result.reserve(values.size() + other.values.size());
+    std::set_union(values.begin(), values.end(), other.values.begin(),
+                   other.values.end(), std::back_inserter(result));
+    values = std::move(result);
+    count = static_cast<uint32_t>(values.size());
+    if (values.size() > ARRAY_LIMIT) {
+      ToBitmap();
+    }
+    return;
+  }
+  if (!IsBitmap()) {
+    ToBitmap();
+  }
+  if (other.IsBitmap()) {
+    count = 0;
+    for (size_t i = 0; i < BITMAP_WORDS; ++i) {
+      words[i] |= other.words[i];
+      count += __builtin_popcountll(words[i]);
+    }
+  } else {
+    for (uint16_t low : other.values) {
+      Set(low);
+    }
+  }
+}
+
+void DocumentBitmap::Block::ToBitmap() {
+  words.assign(BITMAP_WORDS, 0);
+  for (uint16_t low : values) {
+    words[low / 64] |= uint64_t(1) << (low % 64);
+  }
+  values = std::vector<uint16_t>();
+}
+
+void DocumentBitmap::Block::ToArray() {
+  values.clear();
+  values.reserve(count);
+  for (size_t i = 0; i < BITMAP_WORDS; ++i) {
+    for (uint64_t word = words[i]; word != 0; word &= word - 1) {
+      values.push_back(static_cast<uint16_t>(i * 64 + __builtin_ctzll(word)));
+    }
+  }
+  words = std::vector<uint64_t>();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Разреженный битовый набор id документов.
+// id делятся на блоки по 2^16 значений (как в roaring bitmap). Блок с
+// небольшим числом документов хранит отсортированный массив младших
+// 16 бит, плотный - битовую карту на 8 КБ. Изменение одного id стоит
+// логарифм от числа блоков плюс сдвиг не больше ARRAY_LIMIT элементов,
+// а память пропорциональна числу документов, а не максимальному id.
+class DocumentBitmap {
+public:
+  void Set(int document_id);
+  void Reset(int document_id);
+  bool Test(int document_id) const;
+
+  size_t count() const { return count_; }
+  bool empty() const { return count_ == 0; }
+
+  DocumentBitmap &operator&=(const DocumentBitmap &other);
+  DocumentBitmap &operator|=(const DocumentBitmap &other);
+
+  void ShrinkToFit();
+
+  // Занимаемая память в байтах
+  size_t MemoryUsage() const;
+
+private:
+  static constexpr int BLOCK_BITS = 16;
+  static constexpr uint32_t LOW_MASK = (uint32_t(1) << BLOCK_BITS) - 1;
+  static constexpr size_t BITMAP_WORDS = (size_t(1) << BLOCK_BITS) / 64;
+  // Массив длиннее этого занимает больше битовой карты
+  static constexpr size_t ARRAY_LIMIT = 4096;
+
+  struct Block {
+    // Непуст, если блок хранится битовой картой
+    std::vector<uint64_t> words;
+    std::vector<uint16_t> values;
+    uint32_t count = 0;
+
+    bool IsBitmap() const { return !words.empty(); }
+    bool Test(uint16_t low) const;
+    void Set(uint16_t low);
+    void Reset(uint16_t low);
+    void IntersectWith(const Block &other);
+    void UniteWith(const Block &other);
+    void ToBitmap();
+    void ToArray();
+  };
+
+  std::map<uint32_t, Block> blocks_;
+  size_t count_ = 0;
+};
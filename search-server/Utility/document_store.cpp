@@ -0,0 +1,180 @@
+#include "document_store.h"
+#include "lz_codec.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std::string_literals;
+
+DocumentStore::Handle DocumentStore::Add(std::string_view text) {
+  const Location location{static_cast<uint32_t>(blocks_.size()),
+                          static_cast<uint32_t>(open_block_.size()),
+                          static_cast<uint32_t>(text.size())};
+  Handle handle;
+  if (free_slots_.empty()) {
+    handle = static_cast<Handle>(slots_.size());
+    slots_.push_back(location);
+  } else {
+    handle = free_slots_.back();
+    free_slots_.pop_back();
+    slots_[handle] = location;
+  }
+  open_block_.append(text);
+  open_live_size_ += location.size;
+  if (open_block_.size() >= BLOCK_SIZE) {
+    SealOpenBlock();
+  }
+  return handle;
+}
+
+void DocumentStore::Remove(Handle handle) {
+  const Location location = slots_[handle];
+  slots_[handle].block = FREE_SLOT;
+  free_slots_.push_back(handle);
+  // Пустой текст не держит блок, а его блок мог быть уже освобождён
+  if (location.size == 0) {
+    return;
+  }
+
+  if (location.block == blocks_.size()) {
+    open_live_size_ -= location.size;
+    if (open_live_size_ == 0) {
+      open_block_.clear();
+    }
+    return;
+  }
+  Block &block = blocks_[location.block];
+  block.live_size -= location.size;
+  if (block.live_size == 0) {
+    ReleaseBlock(location.block);
+  }
+}
+
+std::string DocumentStore::Get(Handle handle) const {
+  const Location &location = slots_[handle];
+  // Блок пустого документа мог быть уже освобождён
+  if (location.size == 0) {
+    return {};
+  }
+  if (location.block == blocks_.size()) {
+    return open_block_.substr(location.offset, location.size);
+  }
+  return LoadBlock(location.block)->substr(location.offset, location.size);
+}
+
+void DocumentStore::Compact() {
+  SealOpenBlock();
+
+  // Живые тексты из полупустых блоков переписываются в новые блоки,
+  // номера текстов при этом сохраняются
+  std::vector<bool> is_sparse(blocks_.size());
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    is_sparse[i] = blocks_[i].live_size > 0 &&
+                   blocks_[i].live_size * 2 < blocks_[i].original_size;
+  }
+  std::vector<std::pair<Handle, std::string>> moved_texts;
+  for (Handle handle = 0; handle < slots_.size(); ++handle) {
+    const uint32_t block = slots_[handle].block;
+    if (block != FREE_SLOT && is_sparse[block]) {
+      moved_texts.emplace_back(handle, Get(handle));
+    }
+  }
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    if (is_sparse[i]) {
+      ReleaseBlock(static_cast<uint32_t>(i));
+    }
+  }
+  for (const auto &[handle, text] : moved_texts) {
+    slots_[handle] = {static_cast<uint32_t>(blocks_.size()),
+                      static_cast<uint32_t>(open_block_.size()),
+                      static_cast<uint32_t>(text.size())};
+    open_block_.append(text);
+    open_live_size_ += slots_[handle].size;
+    if (open_block_.size() >= BLOCK_SIZE) {
+      SealOpenBlock();
+    }
+  }
+  SealOpenBlock();
+  slots_.shrink_to_fit();
+  free_slots_.shrink_to_fit();
+}
+
+size_t DocumentStore::MemoryUsage() const {
+  size_t usage = sizeof(*this) + slots_.capacity() * sizeof(Location) +
+                 free_slots_.capacity() * sizeof(Handle) +
+                 blocks_.capacity() * sizeof(Block) + compressed_size_ +
+                 open_block_.capacity();
+  std::lock_guard lock(cache_mutex_);
+  for (const auto &[_, text] : cache_) {
+    usage += sizeof(CachedBlock) + 2 * sizeof(void *) + text->capacity();
+  }
+  return usage;
+}
+
+void DocumentStore::SealOpenBlock() {
+  if (open_live_size_ == 0) {
+    open_block_.clear();
+    return;
+  }
+  Block block;
+  block.compressed = LzCompress(open_block_);
+  block.compressed.shrink_to_fit();
+  block.original_size = static_cast<uint32_t>(open_block_.size());
+  block.live_size = open_live_size_;
+  compressed_size_ += block.compressed.capacity();
+  blocks_.push_back(std::move(block));
+  open_block_.clear();
+  open_live_size_ = 0;
+}
+
+void DocumentStore::ReleaseBlock(uint32_t block_index) {
+  Block &block = blocks_[block_index];
+  compressed_size_ -= block.compressed.capacity();
+  std::string().swap(block.compressed);
+  block.original_size = 0;
+  block.live_size = 0;
+
+  std::lock_guard lock(cache_mutex_);
+  cache_.remove_if([block_index](const CachedBlock &cached) {
+    return cached.first == block_index;
+  });
+}
+
+std::shared_ptr<const std::string>
+DocumentStore::LoadBlock(uint32_t block_index) const {
+  {
+    std::lock_guard lock(cache_mutex_);
+    if (auto text = FindCachedBlock(block_index)) {
+      return text;
+    }
+  }
+
+  // Распаковка идёт без блокировки, чтобы не задерживать чтение других блоков
+  const Block &block = blocks_[block_index];
+  auto text = std::make_shared<const std::string>(
+      LzDecompress(block.compressed, block.original_size));
+
+  std::lock_guard lock(cache_mutex_);
+  // Пока блок распаковывался, его мог положить в кэш другой поток
+  if (auto cached_text = FindCachedBlock(block_index)) {
+    return cached_text;
+  }
+  cache_.emplace_front(block_index, text);
+  if (cache_.size() > CACHE_BLOCKS) {
+    cache_.pop_back();
+  }
+  return text;
+}
+
+std::shared_ptr<const std::string>
+DocumentStore::FindCachedBlock(uint32_t block_index) const {
+  const auto cached = std::find_if(cache_.begin(), cache_.end(),
+                                   [block_index](const CachedBlock &cached) {
+                                     return cached.first == block_index;
+                                   });
+  if (cached == cache_.end()) {
+    return nullptr;
+  }
+  cache_.splice(cache_.begin(), cache_, cached);
+  return cached->second;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Хранилище текстов документов.
+// Тексты дописываются в открытый блок; заполненный блок сжимается
+// LzCompress. Сжатый блок распаковывается только при чтении текста из него,
+// несколько последних распакованных блоков хранятся в кэше.
+// Get можно вызывать из нескольких потоков, изменения - нет.
+class DocumentStore {
+public:
+  // Размер несжатого блока, после которого он сжимается
+  static constexpr size_t BLOCK_SIZE = 32 * 1024;
+  // Сколько распакованных блоков держит кэш
+  static constexpr size_t CACHE_BLOCKS = 4;
+
+  // Номер текста в хранилище. Не меняется при уплотнении и освобождается
+  // при удалении, поэтому хранится вместо текста в описании документа.
+  using Handle = uint32_t;
+
+  DocumentStore() = default;
+  DocumentStore(const DocumentStore &) = delete;
+  DocumentStore &operator=(const DocumentStore &) = delete;
+
+  Handle Add(std::string_view text);
+  void Remove(Handle handle);
+
+  std::string Get(Handle handle) const;
+
+  // Сжимает открытый блок и переупаковывает блоки,
+  // в которых удалено больше половины текста
+  void Compact();
+
+  // Занимаемая память в байтах вместе с кэшем
+  size_t MemoryUsage() const;
+
+private:
+  struct Location {
+    uint32_t block;
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  struct Block {
+    std::string compressed;
+    uint32_t original_size = 0;
+    // Размер текстов, которые ещё не удалены
+    uint32_t live_size = 0;
+  };
+
+  using CachedBlock = std::pair<uint32_t, std::shared_ptr<const std::string>>;
+
+  // Признак свободного слота в Location::block
+  static constexpr uint32_t FREE_SLOT = UINT32_MAX;
+
+  std::vector<Location> slots_;
+  std::vector<Handle> free_slots_;
+  // Номер открытого блока - blocks_.size()
+  std::vector<Block> blocks_;
+  std::string open_block_;
+  uint32_t open_live_size_ = 0;
+  size_t compressed_size_ = 0;
+
+  mutable std::mutex cache_mutex_;
+  // Недавно прочитанные блоки, последний прочитанный - первый
+  mutable std::list<CachedBlock> cache_;
+
+  void SealOpenBlock();
+  void ReleaseBlock(uint32_t block);
+  std::shared_ptr<const std::string> LoadBlock(uint32_t block) const;
+  // Блок из кэша или nullptr; вызывается под cache_mutex_
+  std::shared_ptr<const std::string> FindCachedBlock(uint32_t block) const;
+};
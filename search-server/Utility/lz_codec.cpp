@@ -0,0 +1,157 @@
+#include "lz_codec.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std::string_literals;
+
+namespace {
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = 0xFFFF;
+constexpr int HASH_BITS = 12;
+// Последние байты всегда идут литералами, чтобы поиск совпадения
+// не читал за концом входа
+constexpr size_t LAST_LITERALS = 5;
+
+uint32_t Read32(const char *data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint32_t Hash(uint32_t value) {
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Длина сверх 15 дописывается байтами по 255 и остатком
+void WriteLength(std::string &output, size_t length) {
+  for (; length >= 255; length -= 255) {
+    output.push_back(static_cast<char>(255));
+  }
+  output.push_back(static_cast<char>(length));
+}
+
+void WriteSequence(std::string &output, std::string_view literals,
+                   size_t match_length, size_t offset) {
+  const size_t match_code = match_length == 0 ? 0 : match_length - MIN_MATCH;
+  const uint8_t token =
+      static_cast<uint8_t>(std::min<size_t>(literals.size(), 15) << 4 |
+                           std::min<size_t>(match_code, 15));
+  output.push_back(static_cast<char>(token));
+  if (literals.size() >= 15) {
+    WriteLength(output, literals.size() - 15);
+  }
+  output.append(literals);
+  if (match_length == 0) {
+    return;
+  }
+  output.push_back(static_cast<char>(offset & 0xFF));
+  output.push_back(static_cast<char>(offset >> 8));
+  if (match_code >= 15) {
+    WriteLength(output, match_code - 15);
+  }
+}
+
+} // namespace
+
+std::string LzCompress(std::string_view input) {
+  std::string output;
+  output.reserve(input.size() / 2 + 16);
+  // Позиция + 1 последнего вхождения четырёх байт с данным хешем
+  std::array<uint32_t, 1 << HASH_BITS> last_positions{};
+
+  size_t anchor = 0;
+  size_t position = 0;
+  while (input.size() >= LAST_LITERALS &&
+         position + MIN_MATCH <= input.size() - LAST_LITERALS) {
+    const uint32_t bytes = Read32(input.data() + position);
+    uint32_t &last = last_positions[Hash(bytes)];
+    const size_t candidate = last;
+    last = static_cast<uint32_t>(position + 1);
+    if (candidate == 0 || position - (candidate - 1) > MAX_OFFSET ||
+        Read32(input.data() + candidate - 1) != bytes) {
+      ++position;
+      continue;
+    }
+
+    const size_t match_start = candidate - 1;
+    size_t match_length = MIN_MATCH;
+    const size_t match_limit = input.size() - LAST_LITERALS - position;
+    while (match_length < match_limit &&
+           input[match_start + match_length] == input[position + match_length]) {
+      ++match_length;
+    }
+    WriteSequence(output, input.substr(anchor, position - anchor),
+                  match_length, position - match_start);
+    position += match_length;
+    anchor = position;
+  }
+  WriteSequence(output, input.substr(anchor), 0, 0);
+  return output;
+}
+
+std::string LzDecompress(std::string_view compressed, size_t original_size) {
+  std::string output(original_size, '\0');
+  size_t output_size = 0;
+  size_t position = 0;
+
+  const auto read_byte = [&compressed, &position]() -> uint8_t {
+    if (position >= compressed.size()) {
+      throw std::invalid_argument("Compressed data is truncated"s);
+    }
+    return static_cast<uint8_t>(compressed[position++]);
+  };
+  const auto read_length = [&read_byte](size_t length) {
+    if (length < 15) {
+      return length;
+    }
+    for (uint8_t byte = 255; byte == 255;) {
+      byte = read_byte();
+      length += byte;
+    }
+    return length;
+  };
+
+  for (;;) {
+    const uint8_t token = read_byte();
+    const size_t literal_count = read_length(token >> 4);
+    if (literal_count > compressed.size() - position ||
+        literal_count > original_size - output_size) {
+      throw std::invalid_argument("Compressed data is corrupted"s);
+    }
+    std::memcpy(output.data() + output_size, compressed.data() + position,
+                literal_count);
+    output_size += literal_count;
+    position += literal_count;
+    if (output_size == original_size) {
+      break;
+    }
+
+    const size_t offset_low = read_byte();
+    const size_t offset = offset_low | static_cast<size_t>(read_byte()) << 8;
+    const size_t match_length = read_length(token & 0x0F) + MIN_MATCH;
+    if (offset == 0 || offset > output_size ||
+        match_length > original_size - output_size) {
+      throw std::invalid_argument("Compressed data is corrupted"s);
+    }
+    char *destination = output.data() + output_size;
+    const char *source = destination - offset;
+    if (offset >= match_length) {
+      std::memcpy(destination, source, match_length);
+    } else {
+      // Совпадение перекрывается с собой: копируем побайтно
+      for (size_t i = 0; i < match_length; ++i) {
+        destination[i] = source[i];
+      }
+    }
+    output_size += match_length;
+  }
+  if (position != compressed.size()) {
+    throw std::invalid_argument("Compressed data is corrupted"s);
+  }
+  return output;
+}
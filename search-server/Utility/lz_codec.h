@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Сжатие семейства LZ77 без внешних зависимостей.
+// Поток состоит из последовательностей "литералы + совпадение", как в LZ4:
+// байт-токен (старшие 4 бита - число литералов, младшие - длина совпадения
+// минус 4; значение 15 продолжается байтами по 255), литералы и смещение
+// совпадения (2 байта). Последняя последовательность содержит только литералы.
+std::string LzCompress(std::string_view input);
+
+// Распаковка; original_size - размер исходных данных.
+// Бросает std::invalid_argument, если данные повреждены.
+std::string LzDecompress(std::string_view compressed, size_t original_size);
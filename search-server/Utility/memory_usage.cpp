@@ -0,0 +1,13 @@
+#include "memory_usage.h"
+
+std::ostream &operator<<(std::ostream &out, const MemoryUsage &usage) {
+  return out << "documents: " << usage.documents
+             << ", texts: " << usage.document_texts
+             << ", inverted index: " << usage.inverted_index
+             << ", forward index: " << usage.forward_index
+             << ", ids: " << usage.document_ids
+             << ", dictionary: " << usage.term_dictionary
+             << ", positions: " << usage.positional_index
+             << ", filters: " << usage.filters
+             << ", total: " << usage.Total();
+}
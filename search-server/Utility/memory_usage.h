@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+// Оценка размера узла std::map/std::set: значение и заголовок узла
+// (цвет и три указателя)
+template <typename Value>
+constexpr size_t TREE_NODE_SIZE = sizeof(Value) + 4 * sizeof(void *);
+
+// Память, занимаемая структурами поискового сервера, в байтах
+struct MemoryUsage {
+  // Описания документов (рейтинг, статус) без текста
+  size_t documents = 0;
+  // Хранилище текстов документов: сжатые блоки и кэш распакованных
+  size_t document_texts = 0;
+  // Обратный индекс: слово -> документы
+  size_t inverted_index = 0;
+  // Прямой индекс: документ -> слова
+  size_t forward_index = 0;
+  size_t document_ids = 0;
+  size_t term_dictionary = 0;
+  size_t positional_index = 0;
+  // Битовые наборы статусов и рейтингов
+  size_t filters = 0;
+
+  size_t Total() const {
+    return documents + document_texts + inverted_index + forward_index +
+           document_ids + term_dictionary + positional_index + filters;
+  }
+};
+
+std::ostream &operator<<(std::ostream &out, const MemoryUsage &usage);
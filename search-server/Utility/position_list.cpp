@@ -0,0 +1,32 @@
+#include "position_list.h"
+
+void PositionList::Append(uint32_t position) {
+  uint32_t delta = count_ == 0 ? position : position - last_;
+  while (delta >= 0x80) {
+    bytes_.push_back(static_cast<uint8_t>(delta | 0x80));
+    delta >>= 7;
+  }
+  bytes_.push_back(static_cast<uint8_t>(delta));
+  last_ = position;
+  ++count_;
+}
+
+std::vector<uint32_t> PositionList::Decode() const {
+  std::vector<uint32_t> positions;
+  positions.reserve(count_);
+  uint32_t position = 0;
+  uint32_t delta = 0;
+  int shift = 0;
+  for (const uint8_t byte : bytes_) {
+    delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if (byte & 0x80) {
+      shift += 7;
+      continue;
+    }
+    position += delta;
+    positions.push_back(position);
+    delta = 0;
+    shift = 0;
+  }
+  return positions;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Список позиций слова в документе.
+// Позиции хранятся разностями в формате varint (7 бит на байт),
+// поэтому соседние позиции обычно занимают по одному байту.
+class PositionList {
+public:
+  // Позиции добавляются строго по возрастанию
+  void Append(uint32_t position);
+
+  std::vector<uint32_t> Decode() const;
+
+  size_t size() const { return count_; }
+
+  void ShrinkToFit() { bytes_.shrink_to_fit(); }
+
+  // Занимаемая память в байтах (вместе с самим объектом)
+  size_t MemoryUsage() const { return sizeof(*this) + bytes_.capacity(); }
+
+private:
+  std::vector<uint8_t> bytes_;
+  uint32_t last_ = 0;
+  uint32_t count_ = 0;
+};
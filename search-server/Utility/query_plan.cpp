@@ -0,0 +1,14 @@
+#include "query_plan.h"
+
+std::ostream &operator<<(std::ostream &out, const QueryPlan &plan) {
+  out << "exclude:";
+  for (const auto &term : plan.minus_terms) {
+    out << ' ' << term.word << '(' << term.document_count << ')';
+  }
+  out << "; score:";
+  for (const auto &term : plan.plus_terms) {
+    out << ' ' << term.word << '(' << term.document_count << ')';
+  }
+  return out << "; work: " << plan.estimated_work
+             << "; execution: " << (plan.is_parallel ? "par" : "seq");
+}
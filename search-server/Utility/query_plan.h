@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// План выполнения запроса.
+// Слова указывают в текст запроса или в словарь индекса,
+// поэтому план действителен, пока жив текст запроса.
+struct QueryPlan {
+  struct Term {
+    std::string_view word;
+    size_t document_count = 0;
+  };
+
+  // Плюс-слова по возрастанию длины списка документов
+  std::vector<Term> plus_terms;
+  // Минус-слова: из них до подсчёта релевантности строится набор исключений
+  std::vector<Term> minus_terms;
+  // Оценка работы: суммарная длина просматриваемых списков
+  size_t estimated_work = 0;
+  bool is_parallel = false;
+};
+
+std::ostream &operator<<(std::ostream &out, const QueryPlan &plan);
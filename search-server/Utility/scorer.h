@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Вхождение слова в документ
+struct Posting {
+  // Доля слова среди слов документа
+  double term_freq = 0;
+  // Число слов документа без стоп-слов
+  uint32_t document_length = 0;
+};
+
+// Статистика коллекции на момент запроса, общая для всех его слов
+struct CollectionStats {
+  size_t document_count = 0;
+  double average_document_length = 0;
+};
+
+// Функции ранжирования передаются в поиск параметром шаблона.
+// ForTerm вызывается один раз на слово запроса и возвращает функцию
+// вклада слова в релевантность документа; она встраивается в цикл
+// по списку документов слова.
+
+// TF-IDF: вклад слова - TF * log(N / df)
+struct TfIdfScorer {
+  auto ForTerm(const CollectionStats &stats, size_t document_freq) const {
+    const double inverse_document_freq =
+        std::log(stats.document_count * 1.0 / document_freq);
+    return [inverse_document_freq](const Posting &posting) {
+      return posting.term_freq * inverse_document_freq;
+    };
+  }
+};
+
+// Okapi BM25: частота слова насыщается с ростом (k1), длинные документы
+// штрафуются относительно средней длины (b)
+struct Bm25Scorer {
+  double k1 = 1.2;
+  double b = 0.75;
+
+  auto ForTerm(const CollectionStats &stats, size_t document_freq) const {
+    const double inverse_document_freq =
+        std::log(1.0 + (stats.document_count - document_freq + 0.5) /
+                           (document_freq + 0.5));
+    // Нормировка по длине: k1 * (1 - b + b * length / average_length)
+    const double length_base = k1 * (1.0 - b);
+    const double length_factor = stats.average_document_length > 0
+                                     ? k1 * b / stats.average_document_length
+                                     : 0.0;
+    const double saturation = k1 + 1.0;
+    return [inverse_document_freq, length_base, length_factor,
+            saturation](const Posting &posting) {
+      const double term_count = posting.term_freq * posting.document_length;
+      const double length_norm =
+          length_base + length_factor * posting.document_length;
+      return inverse_document_freq * term_count * saturation /
+             (term_count + length_norm);
+    };
+  }
+};
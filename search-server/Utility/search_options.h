@@ -0,0 +1,91 @@
+#pragma once
+
+#include "document.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Флаг отмены, разделяемый между вызывающим кодом и поиском
+class CancellationToken {
+public:
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  bool IsCancelled() const {
+    return cancelled_.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<bool> cancelled_ = false;
+};
+
+// Как сочетаются плюс-слова запроса
+enum class MatchMode {
+  // Документ содержит хотя бы одно плюс-слово
+  ANY,
+  // Документ содержит все плюс-слова
+  ALL,
+};
+
+// Ограничения на время выполнения поиска и режим сопоставления
+struct SearchOptions {
+  using Clock = std::chrono::steady_clock;
+
+  std::optional<Clock::time_point> deadline;
+  std::shared_ptr<const CancellationToken> cancellation;
+  MatchMode match_mode = MatchMode::ANY;
+};
+
+// Результат поиска с ограничениями.
+// Если бюджет исчерпан, documents содержит лучшие из найденных к этому
+// моменту документов, а is_complete == false.
+struct SearchResult {
+  std::vector<Document> documents;
+  bool is_complete = true;
+};
+
+// Кооперативная проверка ограничений внутри циклов по спискам документов.
+// Безопасна для одновременного использования из нескольких потоков.
+class SearchBudget {
+public:
+  // Как часто (в просмотренных документах) проверяются ограничения
+  static constexpr size_t CHECK_INTERVAL = 1024;
+
+  SearchBudget() = default;
+
+  explicit SearchBudget(const SearchOptions &options)
+      : deadline_(options.deadline), cancellation_(options.cancellation),
+        is_limited_(deadline_ || cancellation_) {}
+
+  bool IsLimited() const { return is_limited_; }
+
+  // true, если поиск нужно прекратить
+  bool Exhausted() const {
+    if (!is_limited_) {
+      return false;
+    }
+    if (exhausted_.load(std::memory_order_relaxed)) {
+      return true;
+    }
+    if ((cancellation_ && cancellation_->IsCancelled()) ||
+        (deadline_ && SearchOptions::Clock::now() >= *deadline_)) {
+      exhausted_.store(true, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  // Был ли поиск прерван
+  bool WasExhausted() const {
+    return exhausted_.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::optional<SearchOptions::Clock::time_point> deadline_;
+  std::shared_ptr<const CancellationToken> cancellation_;
+  bool is_limited_ = false;
+  mutable std::atomic<bool> exhausted_ = false;
+};
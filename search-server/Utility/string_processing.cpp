@@ -1,14 +1,55 @@
 #include "string_processing.h"
 
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+
 std::vector<std::string_view> SplitIntoWords(std::string_view text) {
   std::vector<std::string_view> words;
-  size_t first = text.find_first_not_of(' ');
-  size_t last = text.npos;
-  for (size_t space = text.find(' ', first); first != last;
-       first = text.find_first_not_of(' ', space),
-              space = text.find(' ', first)) {
-    words.push_back(space == last ? text.substr(first)
-                                  : text.substr(first, space - first));
-  }
+  ForEachWord(text, [&words](std::string_view word) { words.push_back(word); });
   return words;
 }
+
+int EditDistance(std::string_view lhs, std::string_view rhs,
+                 int max_distance) {
+  const int lhs_size = static_cast<int>(lhs.size());
+  const int rhs_size = static_cast<int>(rhs.size());
+  if (std::abs(lhs_size - rhs_size) > max_distance) {
+    return max_distance + 1;
+  }
+  // Три последние строки матрицы: перестановке нужна строка i - 2.
+  // Для обычных слов они помещаются в буфер на стеке.
+  constexpr int STACK_ROW_SIZE = 64;
+  std::array<int, 3 * STACK_ROW_SIZE> stack_rows;
+  std::vector<int> heap_rows;
+  int *before_previous = stack_rows.data();
+  if (rhs_size + 1 > STACK_ROW_SIZE) {
+    heap_rows.resize(3 * (rhs_size + 1));
+    before_previous = heap_rows.data();
+  }
+  int *previous = before_previous + rhs_size + 1;
+  int *current = previous + rhs_size + 1;
+  for (int j = 0; j <= rhs_size; ++j) {
+    previous[j] = j;
+  }
+  for (int i = 1; i <= lhs_size; ++i) {
+    current[0] = i;
+    int row_min = current[0];
+    for (int j = 1; j <= rhs_size; ++j) {
+      const int cost = lhs[i - 1] == rhs[j - 1] ? 0 : 1;
+      current[j] = std::min({previous[j] + 1, current[j - 1] + 1,
+                             previous[j - 1] + cost});
+      if (i > 1 && j > 1 && lhs[i - 1] == rhs[j - 2] &&
+          lhs[i - 2] == rhs[j - 1]) {
+        current[j] = std::min(current[j], before_previous[j - 2] + 1);
+      }
+      row_min = std::min(row_min, current[j]);
+    }
+    if (row_min > max_distance) {
+      return max_distance + 1;
+    }
+    std::swap(before_previous, previous);
+    std::swap(previous, current);
+  }
+  return std::min(previous[rhs_size], max_distance + 1);
+}
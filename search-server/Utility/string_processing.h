@@ -10,6 +10,21 @@ using namespace std::string_literals;
 
 std::vector<std::string_view> SplitIntoWords(std::string_view text);
 
+// Расстояние редактирования (перестановка соседних букв - одна правка).
+// Если оно больше max_distance, возвращается max_distance + 1.
+int EditDistance(std::string_view lhs, std::string_view rhs, int max_distance);
+
+// Обход слов текста без выделения памяти
+template <typename Callback>
+void ForEachWord(std::string_view text, Callback callback) {
+  size_t first = text.find_first_not_of(' ');
+  while (first != text.npos) {
+    const size_t space = text.find(' ', first);
+    callback(text.substr(first, space == text.npos ? space : space - first));
+    first = text.find_first_not_of(' ', space);
+  }
+}
+
 template <typename StringContainer>
 std::set<std::string, std::less<>>
 MakeUniqueNonEmptyStrings(const StringContainer &strings) {
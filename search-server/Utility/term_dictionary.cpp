@@ -0,0 +1,379 @@
+#include "term_dictionary.h"
+#include "string_processing.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+namespace {
+
+// Обход отсортированных терминов как неявного префиксного дерева.
+// Термины с общим префиксом идут подряд, и у них общая строка матрицы
+// расстояния до слова (та же, что в EditDistance, с перестановками).
+// Ветвь отбрасывается, когда вся строка больше max_distance: дальше
+// расстояние только растёт.
+class SimilarTermsSearch {
+public:
+  SimilarTermsSearch(const std::vector<std::string_view> &terms,
+                     const std::vector<uint32_t> &document_counts,
+                     std::string_view word, int max_distance,
+                     std::vector<std::pair<int, int>> &result)
+      : terms_(terms), document_counts_(document_counts), word_(word),
+        max_distance_(max_distance), max_depth_(word.size() + max_distance),
+        width_(word.size() + 1), rows_((max_depth_ + 1) * width_),
+        result_(result) {
+    for (size_t j = 0; j < width_; ++j) {
+      rows_[j] = static_cast<int>(j);
+    }
+  }
+
+  // sorted_ids - id терминов в лексикографическом порядке
+  void Run(const std::vector<int> &sorted_ids) {
+    if (!sorted_ids.empty()) {
+      Visit(sorted_ids, 0, sorted_ids.size(), 0, 0);
+    }
+  }
+
+private:
+  const std::vector<std::string_view> &terms_;
+  const std::vector<uint32_t> &document_counts_;
+  const std::string_view word_;
+  const int max_distance_;
+  const size_t max_depth_;
+  const size_t width_;
+  // Строка depth - расстояния от префикса длины depth до начал слова
+  std::vector<int> rows_;
+  std::vector<std::pair<int, int>> &result_;
+
+  int *Row(size_t depth) { return rows_.data() + depth * width_; }
+
+  // Первый индекс в [begin, end), где predicate ложен. Поиск с
+  // удвоением шага: поддеревья глубже корня обычно короткие
+  template <typename Predicate>
+  static size_t PartitionPoint(const std::vector<int> &ids, size_t begin,
+                               size_t end, Predicate predicate) {
+    size_t step = 1;
+    while (begin + step < end && predicate(ids[begin + step - 1])) {
+      begin += step;
+      step *= 2;
+    }
+    return std::partition_point(ids.begin() + begin,
+                                ids.begin() + std::min(begin + step, end),
+                                predicate) -
+           ids.begin();
+  }
+
+  // [begin, end) - термины с общим префиксом длины depth,
+  // его строка уже посчитана, row_min - её минимум
+  void Visit(const std::vector<int> &ids, size_t begin, size_t end,
+             size_t depth, int row_min) {
+    const std::string_view prefix = terms_[ids[begin]].substr(0, depth);
+    if (terms_[ids[begin]].size() == depth) {
+      const int distance = Row(depth)[word_.size()];
+      if (distance > 0 && distance <= max_distance_ &&
+          document_counts_[ids[begin]] > 0) {
+        result_.emplace_back(ids[begin], distance);
+      }
+      ++begin;
+    }
+    if (depth == max_depth_ || begin == end) {
+      return;
+    }
+    if (row_min < max_distance_) {
+      // Годится любая следующая буква
+      while (begin < end) {
+        const char letter = terms_[ids[begin]][depth];
+        const size_t child_end =
+            PartitionPoint(ids, begin, end, [this, depth, letter](int term_id) {
+              return terms_[term_id][depth] == letter;
+            });
+        VisitChild(ids, begin, child_end, prefix, letter);
+        begin = child_end;
+      }
+      return;
+    }
+    // Запаса нет: без роста расстояния продолжают только буквы слова
+    // напротив клеток со значением max_distance и перестановки
+    std::array<unsigned char, 2 * TermDictionary::MAX_SIMILAR_WORD_LENGTH>
+        letters;
+    size_t letter_count = 0;
+    const int *row = Row(depth);
+    for (size_t j = 0; j < word_.size(); ++j) {
+      if (row[j] <= max_distance_) {
+        letters[letter_count++] = word_[j];
+      }
+    }
+    if (depth > 0) {
+      const int *previous = Row(depth - 1);
+      for (size_t j = 0; j + 1 < word_.size(); ++j) {
+        if (previous[j] < max_distance_) {
+          letters[letter_count++] = word_[j];
+        }
+      }
+    }
+    std::sort(letters.begin(), letters.begin() + letter_count);
+    const auto letters_end =
+        std::unique(letters.begin(), letters.begin() + letter_count);
+    for (auto letter = letters.begin(); letter != letters_end && begin < end;
+         ++letter) {
+      // Строки сравниваются как unsigned char
+      const auto letter_at = [this, depth](int term_id) {
+        return static_cast<unsigned char>(terms_[term_id][depth]);
+      };
+      begin = PartitionPoint(ids, begin, end, [&](int term_id) {
+        return letter_at(term_id) < *letter;
+      });
+      const size_t child_end = PartitionPoint(ids, begin, end, [&](int term_id) {
+        return letter_at(term_id) == *letter;
+      });
+      if (begin < child_end) {
+        VisitChild(ids, begin, child_end, prefix, static_cast<char>(*letter));
+      }
+      begin = child_end;
+    }
+  }
+
+  void VisitChild(const std::vector<int> &ids, size_t begin, size_t end,
+                  std::string_view prefix, char letter) {
+    const size_t depth = prefix.size() + 1;
+    const int row_min = ComputeRow(prefix, letter, depth);
+    if (row_min <= max_distance_) {
+      Visit(ids, begin, end, depth, row_min);
+    }
+  }
+
+  // Строка для префикса prefix + letter длины depth; возвращает её минимум
+  int ComputeRow(std::string_view prefix, char letter, size_t depth) {
+    const int *previous = Row(depth - 1);
+    int *current = Row(depth);
+    current[0] = static_cast<int>(depth);
+    int row_min = current[0];
+    for (size_t j = 1; j < width_; ++j) {
+      const int cost = letter == word_[j - 1] ? 0 : 1;
+      current[j] = std::min({previous[j] + 1, current[j - 1] + 1,
+                             previous[j - 1] + cost});
+      if (depth > 1 && j > 1 && letter == word_[j - 2] &&
+          prefix[depth - 2] == word_[j - 1]) {
+        current[j] = std::min(current[j], Row(depth - 2)[j - 2] + 1);
+      }
+      row_min = std::min(row_min, current[j]);
+    }
+    return row_min;
+  }
+};
+
+} // namespace
+
+int TermDictionary::Insert(std::string_view term) {
+  const int found = Find(term);
+  if (found != NOT_FOUND) {
+    return found;
+  }
+  const auto [stored, chunk] = Store(term);
+  int term_id = 0;
+  if (free_ids_.empty()) {
+    term_id = static_cast<int>(terms_.size());
+    terms_.push_back(stored);
+    document_counts_.push_back(0);
+    term_chunks_.push_back(chunk);
+  } else {
+    term_id = free_ids_.back();
+    free_ids_.pop_back();
+    terms_[term_id] = stored;
+    term_chunks_[term_id] = chunk;
+  }
+  // До первого документа термин считается неиспользуемым
+  ++unused_count_;
+  pending_ids_.insert(LowerBound(pending_ids_, stored), term_id);
+
+  // Порог растёт как корень из размера словаря: слияние стоит O(n),
+  // поэтому на одну вставку в среднем приходится O(sqrt(n)),
+  // как и на сдвиг буфера
+  const size_t pending_limit = std::max(
+      MIN_PENDING_LIMIT, static_cast<size_t>(std::sqrt(terms_.size()) * 4));
+  if (pending_ids_.size() > pending_limit) {
+    Compact();
+  }
+  return term_id;
+}
+
+int TermDictionary::Find(std::string_view term) const {
+  const auto sorted = LowerBound(sorted_ids_, term);
+  if (sorted != sorted_ids_.end() && terms_[*sorted] == term) {
+    return *sorted;
+  }
+  const auto pending = LowerBound(pending_ids_, term);
+  return pending != pending_ids_.end() && terms_[*pending] == term
+             ? *pending
+             : NOT_FOUND;
+}
+
+void TermDictionary::AddReference(int term_id) {
+  if (document_counts_[term_id]++ == 0) {
+    --unused_count_;
+  }
+}
+
+void TermDictionary::RemoveReference(int term_id) {
+  if (--document_counts_[term_id] == 0) {
+    ++unused_count_;
+  }
+}
+
+bool TermDictionary::HasManyUnused() const {
+  const size_t used_count = terms_.size() - free_ids_.size() - unused_count_;
+  return unused_count_ > std::max(MIN_UNUSED_LIMIT, used_count);
+}
+
+void TermDictionary::RemoveUnused() {
+  if (unused_count_ == 0) {
+    return;
+  }
+  const auto is_unused = [this](int term_id) {
+    return document_counts_[term_id] == 0;
+  };
+  sorted_ids_.erase(
+      std::remove_if(sorted_ids_.begin(), sorted_ids_.end(), is_unused),
+      sorted_ids_.end());
+  pending_ids_.erase(
+      std::remove_if(pending_ids_.begin(), pending_ids_.end(), is_unused),
+      pending_ids_.end());
+
+  for (int term_id = 0; term_id < static_cast<int>(terms_.size()); ++term_id) {
+    if (terms_[term_id].empty() || !is_unused(term_id)) {
+      continue;
+    }
+    chunks_[term_chunks_[term_id]].live_size -= terms_[term_id].size();
+    terms_[term_id] = {};
+    free_ids_.push_back(term_id);
+  }
+  for (uint32_t chunk = 0; chunk < chunks_.size(); ++chunk) {
+    if (chunks_[chunk].data && chunks_[chunk].live_size == 0 &&
+        chunk != open_chunk_) {
+      chunks_memory_ -= chunks_[chunk].size;
+      chunks_[chunk] = Chunk();
+      free_chunks_.push_back(chunk);
+    }
+  }
+  unused_count_ = 0;
+}
+
+std::vector<int> TermDictionary::FindByPrefix(std::string_view prefix) const {
+  std::vector<int> result;
+  ForEachWithPrefix(prefix, [&result](int term_id) {
+    result.push_back(term_id);
+    return true;
+  });
+  return result;
+}
+
+std::vector<std::pair<int, int>>
+TermDictionary::FindSimilar(std::string_view term, int max_distance) const {
+  std::vector<std::pair<int, int>> result;
+  if (max_distance <= 0 || term.size() > MAX_SIMILAR_WORD_LENGTH) {
+    return result;
+  }
+  SimilarTermsSearch search(terms_, document_counts_, term, max_distance,
+                            result);
+  search.Run(sorted_ids_);
+  search.Run(pending_ids_);
+  return result;
+}
+
+void TermDictionary::Compact() {
+  if (pending_ids_.empty()) {
+    return;
+  }
+  std::vector<int> merged;
+  merged.reserve(sorted_ids_.size() + pending_ids_.size());
+  auto sorted = sorted_ids_.begin();
+  for (const int term_id : pending_ids_) {
+    while (sorted != sorted_ids_.end() && terms_[*sorted] < terms_[term_id]) {
+      merged.push_back(*sorted++);
+    }
+    merged.push_back(term_id);
+  }
+  merged.insert(merged.end(), sorted, sorted_ids_.end());
+  sorted_ids_ = std::move(merged);
+  pending_ids_.clear();
+}
+
+void TermDictionary::ShrinkToFit() {
+  RemoveUnused();
+  Compact();
+  while (!terms_.empty() && terms_.back().empty()) {
+    terms_.pop_back();
+  }
+  const int size = static_cast<int>(terms_.size());
+  free_ids_.erase(
+      std::remove_if(free_ids_.begin(), free_ids_.end(),
+                     [size](int term_id) { return term_id >= size; }),
+      free_ids_.end());
+  document_counts_.resize(terms_.size());
+  term_chunks_.resize(terms_.size());
+  terms_.shrink_to_fit();
+  document_counts_.shrink_to_fit();
+  term_chunks_.shrink_to_fit();
+  free_ids_.shrink_to_fit();
+  pending_ids_.shrink_to_fit();
+  sorted_ids_.shrink_to_fit();
+}
+
+size_t TermDictionary::MemoryUsage() const {
+  return sizeof(*this) + chunks_memory_ + chunks_.capacity() * sizeof(Chunk) +
+         free_chunks_.capacity() * sizeof(uint32_t) +
+         terms_.capacity() * sizeof(std::string_view) +
+         (document_counts_.capacity() + term_chunks_.capacity()) *
+             sizeof(uint32_t) +
+         free_ids_.capacity() * sizeof(int) +
+         sorted_ids_.capacity() * sizeof(int) +
+         pending_ids_.capacity() * sizeof(int);
+}
+
+std::vector<int>::const_iterator
+TermDictionary::LowerBound(const std::vector<int> &ids,
+                           std::string_view value) const {
+  return std::lower_bound(ids.begin(), ids.end(), value,
+                          [this](int term_id, std::string_view value) {
+                            return terms_[term_id] < value;
+                          });
+}
+
+std::pair<std::string_view, uint32_t>
+TermDictionary::Store(std::string_view term) {
+  uint32_t chunk = 0;
+  char *data = nullptr;
+  if (term.size() > CHUNK_SIZE / 2) {
+    // Длинный термин получает отдельный блок, текущий остаётся открытым
+    chunk = AllocateChunk(term.size());
+    data = chunks_[chunk].data.get();
+  } else {
+    if (term.size() > chunk_free_) {
+      open_chunk_ = AllocateChunk(CHUNK_SIZE);
+      chunk_free_ = CHUNK_SIZE;
+    }
+    chunk = open_chunk_;
+    data = chunks_[chunk].data.get() + (CHUNK_SIZE - chunk_free_);
+    chunk_free_ -= term.size();
+  }
+  chunks_[chunk].live_size += term.size();
+  std::memcpy(data, term.data(), term.size());
+  return {{data, term.size()}, chunk};
+}
+
+uint32_t TermDictionary::AllocateChunk(size_t size) {
+  uint32_t chunk = 0;
+  if (free_chunks_.empty()) {
+    chunk = static_cast<uint32_t>(chunks_.size());
+    chunks_.emplace_back();
+  } else {
+    chunk = free_chunks_.back();
+    free_chunks_.pop_back();
+  }
+  chunks_[chunk].data = std::make_unique<char[]>(size);
+  chunks_[chunk].size = size;
+  chunks_memory_ += size;
+  return chunk;
+}
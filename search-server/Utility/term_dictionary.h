@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Словарь терминов индекса.
+// Владеет строками терминов и выдаёт им плотные id.
+// Строки лежат в блоках фиксированного размера и никогда не перемещаются,
+// поэтому string_view на термин действителен, пока термин не удалён.
+// Для поиска поддерживается отсортированный массив id; новые термины
+// копятся в небольшом буфере и периодически вливаются в массив.
+// Словарь считает документы каждого термина. Термины без документов
+// пропускаются при обходе и удаляются RemoveUnused: их id используются
+// повторно, а блок строк освобождается, когда в нём не остаётся терминов.
+class TermDictionary {
+public:
+  static constexpr int NOT_FOUND = -1;
+
+  // Возвращает id термина, добавляя его при необходимости
+  int Insert(std::string_view term);
+
+  // id термина или NOT_FOUND
+  int Find(std::string_view term) const;
+
+  std::string_view GetTerm(int term_id) const { return terms_[term_id]; }
+
+  // Учёт документов, в которых есть термин
+  void AddReference(int term_id);
+  void RemoveReference(int term_id);
+
+  // id терминов с документами и заданным префиксом в лексикографическом
+  // порядке. Время пропорционально числу найденных терминов (плюс логарифм
+  // и ещё не удалённые термины без документов).
+  std::vector<int> FindByPrefix(std::string_view prefix) const;
+  // То же без выделения памяти: callback(term_id) для каждого термина.
+  // Обход прекращается, как только callback вернёт false или будет
+  // просмотрено max_visited терминов, считая термины без документов.
+  template <typename Callback>
+  void ForEachWithPrefix(std::string_view prefix, Callback callback,
+                         size_t max_visited = SIZE_MAX) const;
+
+  // Верхняя граница id терминов
+  size_t size() const { return terms_.size(); }
+
+  // Удаляет термины без документов. string_view на них становятся
+  // недействительными, а id могут достаться новым терминам.
+  void RemoveUnused();
+  // Терминов без документов больше, чем с документами
+  bool HasManyUnused() const;
+
+  // Длиннее слова FindSimilar не исправляет
+  static constexpr size_t MAX_SIMILAR_WORD_LENGTH = 64;
+
+  // Термины с документами на расстоянии редактирования от 1 до
+  // max_distance: пары (id, расстояние). Отсортированный массив обходится
+  // как префиксное дерево, и ветви, где префикс уже дальше max_distance
+  // от любого начала слова, отбрасываются. Время зависит от числа
+  // префиксов словаря рядом со словом, а не от размера словаря.
+  std::vector<std::pair<int, int>> FindSimilar(std::string_view term,
+                                               int max_distance) const;
+
+  // Вливает буфер новых терминов в отсортированный массив
+  void Compact();
+  // Удаляет термины без документов, отбрасывает свободные id в конце
+  // и возвращает лишнюю ёмкость массивов
+  void ShrinkToFit();
+
+  // Занимаемая память в байтах
+  size_t MemoryUsage() const;
+
+private:
+  static constexpr size_t CHUNK_SIZE = 64 * 1024;
+  static constexpr size_t MIN_PENDING_LIMIT = 1024;
+  static constexpr size_t MIN_UNUSED_LIMIT = 1024;
+
+  struct Chunk {
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+    // Суммарная длина неудалённых терминов в блоке
+    size_t live_size = 0;
+  };
+
+  std::vector<Chunk> chunks_;
+  std::vector<uint32_t> free_chunks_;
+  // Блок, в который дописываются короткие термины
+  uint32_t open_chunk_ = UINT32_MAX;
+  size_t chunk_free_ = 0;
+  size_t chunks_memory_ = 0;
+
+  // У удалённого термина пустая строка, его id лежит в free_ids_
+  std::vector<std::string_view> terms_;
+  std::vector<uint32_t> document_counts_;
+  std::vector<uint32_t> term_chunks_;
+  std::vector<int> free_ids_;
+  // Термины без документов, ещё не удалённые RemoveUnused
+  size_t unused_count_ = 0;
+  std::vector<int> sorted_ids_;
+  // Буфер новых терминов, тоже упорядоченный по строкам
+  std::vector<int> pending_ids_;
+
+  // Первый id в ids, чей термин не меньше value
+  std::vector<int>::const_iterator LowerBound(const std::vector<int> &ids,
+                                             std::string_view value) const;
+
+  // Копирует строку в блок; возвращает её и номер блока
+  std::pair<std::string_view, uint32_t> Store(std::string_view term);
+  uint32_t AllocateChunk(size_t size);
+};
+
+template <typename Callback>
+void TermDictionary::ForEachWithPrefix(std::string_view prefix,
+                                       Callback callback,
+                                       size_t max_visited) const {
+  const auto has_prefix = [prefix](std::string_view term) {
+    return term.substr(0, prefix.size()) == prefix;
+  };
+
+  auto sorted = LowerBound(sorted_ids_, prefix);
+  auto pending = LowerBound(pending_ids_, prefix);
+
+  // Слияние двух отсортированных последовательностей
+  for (size_t visited = 0; visited < max_visited; ++visited) {
+    const bool sorted_ok =
+        sorted != sorted_ids_.end() && has_prefix(terms_[*sorted]);
+    const bool pending_ok =
+        pending != pending_ids_.end() && has_prefix(terms_[*pending]);
+    if (!sorted_ok && !pending_ok) {
+      break;
+    }
+    const int term_id =
+        sorted_ok && (!pending_ok || terms_[*sorted] < terms_[*pending])
+            ? *sorted++
+            : *pending++;
+    if (document_counts_[term_id] > 0 && !callback(term_id)) {
+      break;
+    }
+  }
+}
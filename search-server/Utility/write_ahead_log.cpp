@@ -0,0 +1,356 @@
+#include "write_ahead_log.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std::string_literals;
+
+namespace {
+
+constexpr char SNAPSHOT_MAGIC[4] = {'S', 'S', 'N', 'P'};
+constexpr size_t FRAME_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+template <typename T> void Put(std::string &out, T value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> bool Get(std::string_view &in, T &value) {
+  if (in.size() < sizeof(value)) {
+    return false;
+  }
+  std::memcpy(&value, in.data(), sizeof(value));
+  in.remove_prefix(sizeof(value));
+  return true;
+}
+
+// FNV-1a: достаточно, чтобы отличить недописанную запись
+uint32_t Checksum(std::string_view data) {
+  uint32_t hash = 2166136261u;
+  for (const char c : data) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+  }
+  return hash;
+}
+
+void WriteAll(int fd, std::string_view data) {
+  while (!data.empty()) {
+    const ssize_t written = ::write(fd, data.data(), data.size());
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Write-ahead log write failed: "s +
+                               std::strerror(errno));
+    }
+    data.remove_prefix(written);
+  }
+}
+
+// fsync каталога делает устойчивым переименование файла
+void SyncDirectory(const std::string &path) {
+  const size_t slash = path.rfind('/');
+  const std::string directory =
+      slash == std::string::npos ? "."s : path.substr(0, slash + 1);
+  const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+bool ReadFile(const std::string &path, std::string &content) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  char chunk[64 * 1024];
+  ssize_t size = 0;
+  while ((size = ::read(fd, chunk, sizeof(chunk))) != 0) {
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ::close(fd);
+      throw std::runtime_error("Cannot read "s + path);
+    }
+    content.append(chunk, size);
+  }
+  ::close(fd);
+  return true;
+}
+
+// Разбор одной записи; false, если запись повреждена или не дописана
+bool DecodeRecord(std::string_view &in, uint64_t &lsn,
+                  WriteAheadLog::Record &record) {
+  uint32_t size = 0;
+  uint32_t checksum = 0;
+  if (!Get(in, size) || !Get(in, checksum) || in.size() < size) {
+    return false;
+  }
+  std::string_view payload = in.substr(0, size);
+  if (Checksum(payload) != checksum) {
+    return false;
+  }
+  in.remove_prefix(size);
+
+  uint8_t type = 0;
+  if (!Get(payload, lsn) || !Get(payload, type) ||
+      !Get(payload, record.document_id)) {
+    return false;
+  }
+  record.type = static_cast<WriteAheadLog::RecordType>(type);
+  record.ratings.clear();
+  record.text = {};
+  if (record.type == WriteAheadLog::RecordType::REMOVE) {
+    return true;
+  }
+  uint8_t status = 0;
+  uint32_t rating_count = 0;
+  if (!Get(payload, status) || !Get(payload, rating_count)) {
+    return false;
+  }
+  record.status = static_cast<DocumentStatus>(status);
+  for (uint32_t i = 0; i < rating_count; ++i) {
+    int rating = 0;
+    if (!Get(payload, rating)) {
+      return false;
+    }
+    record.ratings.push_back(rating);
+  }
+  uint32_t text_size = 0;
+  if (!Get(payload, text_size) || payload.size() != text_size) {
+    return false;
+  }
+  record.text = payload;
+  return true;
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(std::string path,
+                             std::chrono::microseconds commit_interval)
+    : path_(std::move(path)), commit_interval_(commit_interval) {
+  fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd_ < 0) {
+    throw std::runtime_error("Cannot open write-ahead log "s + path_ + ": "s +
+                             std::strerror(errno));
+  }
+  flusher_ = std::thread([this] { FlushLoop(); });
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  flush_requested_.notify_one();
+  flusher_.join();
+  ::close(fd_);
+}
+
+void WriteAheadLog::Replay(const std::function<void(const Record &)> &apply) {
+  uint64_t last_lsn = 0;
+  Record record;
+
+  std::string snapshot;
+  if (ReadFile(path_ + ".snapshot"s, snapshot)) {
+    std::string_view in = snapshot;
+    const std::string_view magic(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    if (in.substr(0, magic.size()) != magic) {
+      throw std::runtime_error("Corrupted snapshot "s + path_ + ".snapshot"s);
+    }
+    in.remove_prefix(magic.size());
+    if (!Get(in, last_lsn)) {
+      throw std::runtime_error("Corrupted snapshot "s + path_ + ".snapshot"s);
+    }
+    while (!in.empty()) {
+      uint64_t lsn = 0;
+      if (!DecodeRecord(in, lsn, record)) {
+        throw std::runtime_error("Corrupted snapshot "s + path_ +
+                                 ".snapshot"s);
+      }
+      apply(record);
+    }
+  }
+
+  std::string log;
+  ReadFile(path_, log);
+  std::string_view in = log;
+  size_t valid_size = 0;
+  while (!in.empty()) {
+    uint64_t lsn = 0;
+    if (!DecodeRecord(in, lsn, record)) {
+      break;
+    }
+    valid_size = log.size() - in.size();
+    // Записи до снимка уже в нём учтены
+    if (lsn > last_lsn) {
+      apply(record);
+      last_lsn = lsn;
+    }
+  }
+  if (valid_size != log.size() && ::ftruncate(fd_, valid_size) != 0) {
+    throw std::runtime_error("Cannot truncate write-ahead log "s + path_);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  appended_lsn_ = durable_lsn_ = last_lsn;
+}
+
+uint64_t WriteAheadLog::AppendAdd(int document_id, std::string_view text,
+                                  DocumentStatus status,
+                                  const std::vector<int> &ratings) {
+  Record record;
+  record.type = RecordType::ADD;
+  record.document_id = document_id;
+  record.status = status;
+  record.ratings = ratings;
+  record.text = text;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failed_) {
+    throw std::runtime_error("Write-ahead log "s + path_ + " failed"s);
+  }
+  EncodeRecord(buffer_, ++appended_lsn_, record);
+  return appended_lsn_;
+}
+
+uint64_t WriteAheadLog::AppendRemove(int document_id) {
+  Record record;
+  record.type = RecordType::REMOVE;
+  record.document_id = document_id;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failed_) {
+    throw std::runtime_error("Write-ahead log "s + path_ + " failed"s);
+  }
+  EncodeRecord(buffer_, ++appended_lsn_, record);
+  return appended_lsn_;
+}
+
+void WriteAheadLog::WaitDurable(uint64_t lsn) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++waiters_;
+  flush_requested_.notify_one();
+  flushed_.wait(lock, [this, lsn] { return durable_lsn_ >= lsn || failed_; });
+  --waiters_;
+  if (durable_lsn_ < lsn) {
+    throw std::runtime_error("Write-ahead log "s + path_ + " failed"s);
+  }
+}
+
+uint64_t WriteAheadLog::Sync() {
+  uint64_t lsn = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lsn = appended_lsn_;
+  }
+  WaitDurable(lsn);
+  return lsn;
+}
+
+void WriteAheadLog::FlushLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // Ждём интервал фиксации, если только кто-то не ждёт записи на диск
+    flush_requested_.wait_for(lock, commit_interval_, [this] {
+      return stop_ || (waiters_ > 0 && !buffer_.empty());
+    });
+    if (buffer_.empty() || failed_) {
+      if (stop_) {
+        return;
+      }
+      continue;
+    }
+    flush_buffer_.swap(buffer_);
+    const uint64_t batch_lsn = appended_lsn_;
+    lock.unlock();
+
+    bool ok = true;
+    try {
+      WriteAll(fd_, flush_buffer_);
+      ok = ::fdatasync(fd_) == 0;
+    } catch (const std::runtime_error &) {
+      ok = false;
+    }
+    flush_buffer_.clear();
+
+    lock.lock();
+    if (ok) {
+      durable_lsn_ = batch_lsn;
+    } else {
+      failed_ = true;
+    }
+    flushed_.notify_all();
+  }
+}
+
+void WriteAheadLog::EncodeRecord(std::string &out, uint64_t lsn,
+                                 const Record &record) {
+  const size_t frame_start = out.size();
+  out.resize(out.size() + FRAME_HEADER_SIZE);
+  Put(out, lsn);
+  Put(out, static_cast<uint8_t>(record.type));
+  Put(out, record.document_id);
+  if (record.type == RecordType::ADD) {
+    Put(out, static_cast<uint8_t>(record.status));
+    Put(out, static_cast<uint32_t>(record.ratings.size()));
+    for (const int rating : record.ratings) {
+      Put(out, rating);
+    }
+    Put(out, static_cast<uint32_t>(record.text.size()));
+    out.append(record.text);
+  }
+
+  const std::string_view payload =
+      std::string_view(out).substr(frame_start + FRAME_HEADER_SIZE);
+  const uint32_t size = static_cast<uint32_t>(payload.size());
+  const uint32_t checksum = Checksum(payload);
+  std::memcpy(&out[frame_start], &size, sizeof(size));
+  std::memcpy(&out[frame_start + sizeof(size)], &checksum, sizeof(checksum));
+}
+
+WriteAheadLog::SnapshotFile WriteAheadLog::OpenSnapshot(uint64_t lsn) {
+  SnapshotFile snapshot;
+  const std::string tmp_path = path_ + ".snapshot.tmp"s;
+  snapshot.fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (snapshot.fd < 0) {
+    throw std::runtime_error("Cannot create snapshot "s + tmp_path);
+  }
+  snapshot.buffer.append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  Put(snapshot.buffer, lsn);
+  return snapshot;
+}
+
+void WriteAheadLog::WriteSnapshotRecord(SnapshotFile &snapshot,
+                                        const Record &record) {
+  EncodeRecord(snapshot.buffer, 0, record);
+  if (snapshot.buffer.size() >= 1024 * 1024) {
+    WriteAll(snapshot.fd, snapshot.buffer);
+    snapshot.buffer.clear();
+  }
+}
+
+void WriteAheadLog::CommitSnapshot(SnapshotFile &snapshot) {
+  const std::string tmp_path = path_ + ".snapshot.tmp"s;
+  WriteAll(snapshot.fd, snapshot.buffer);
+  const bool synced = ::fsync(snapshot.fd) == 0;
+  ::close(snapshot.fd);
+  if (!synced ||
+      std::rename(tmp_path.c_str(), (path_ + ".snapshot"s).c_str()) != 0) {
+    throw std::runtime_error("Cannot write snapshot for "s + path_);
+  }
+  SyncDirectory(path_);
+
+  // Снимок на месте, записи журнала до него больше не нужны.
+  // Если сбой случится до очистки, они будут пропущены по LSN.
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (::ftruncate(fd_, 0) != 0 || ::fdatasync(fd_) != 0) {
+    throw std::runtime_error("Cannot truncate write-ahead log "s + path_);
+  }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "document.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Журнал упреждающей записи операций добавления и удаления документов.
+// Записи копятся в буфере, фоновый поток раз в commit_interval записывает
+// их одним вызовом write и одним fdatasync (групповая фиксация).
+// Рядом с журналом хранится снимок (path + ".snapshot"): восстановление
+// читает снимок и затем записи журнала, сделанные после него.
+class WriteAheadLog {
+public:
+  enum class RecordType : uint8_t {
+    ADD = 1,
+    REMOVE = 2,
+  };
+
+  // Запись при восстановлении; text действителен только внутри обработчика
+  struct Record {
+    RecordType type = RecordType::ADD;
+    int document_id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+    std::string_view text;
+  };
+
+  explicit WriteAheadLog(
+      std::string path,
+      std::chrono::microseconds commit_interval = std::chrono::milliseconds(2));
+  ~WriteAheadLog();
+
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  // Передаёт в apply записи снимка и журнала. Повреждённый хвост журнала
+  // (например, после сбоя посреди записи) отбрасывается.
+  void Replay(const std::function<void(const Record &)> &apply);
+
+  // Добавление записей; возвращают номер записи (LSN).
+  // На диск запись попадёт при ближайшей групповой фиксации.
+  uint64_t AppendAdd(int document_id, std::string_view text,
+                     DocumentStatus status, const std::vector<int> &ratings);
+  uint64_t AppendRemove(int document_id);
+
+  // Ожидание, пока запись с номером lsn не окажется на диске
+  void WaitDurable(uint64_t lsn);
+  // Ожидание записи на диск всех добавленных записей; возвращает их LSN
+  uint64_t Sync();
+
+  // Снимок состояния. for_each_record(emit) должен вызвать emit для
+  // каждого документа; после записи снимка журнал очищается.
+  template <typename RecordSource>
+  void Checkpoint(RecordSource for_each_record);
+
+private:
+  struct SnapshotFile {
+    int fd = -1;
+    std::string buffer;
+  };
+
+  const std::string path_;
+  const std::chrono::microseconds commit_interval_;
+  int fd_ = -1;
+
+  std::mutex mutex_;
+  std::condition_variable flush_requested_;
+  std::condition_variable flushed_;
+  std::string buffer_;
+  std::string flush_buffer_;
+  uint64_t appended_lsn_ = 0;
+  uint64_t durable_lsn_ = 0;
+  size_t waiters_ = 0;
+  bool failed_ = false;
+  bool stop_ = false;
+  std::thread flusher_;
+
+  void FlushLoop();
+
+  static void EncodeRecord(std::string &out, uint64_t lsn,
+                           const Record &record);
+
+  SnapshotFile OpenSnapshot(uint64_t lsn);
+  void WriteSnapshotRecord(SnapshotFile &snapshot, const Record &record);
+  void CommitSnapshot(SnapshotFile &snapshot);
+};
+
+template <typename RecordSource>
+void WriteAheadLog::Checkpoint(RecordSource for_each_record) {
+  const uint64_t lsn = Sync();
+  SnapshotFile snapshot = OpenSnapshot(lsn);
+  for_each_record([this, &snapshot](const Record &record) {
+    WriteSnapshotRecord(snapshot, record);
+  });
+  CommitSnapshot(snapshot);
+}